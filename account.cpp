@@ -1,12 +1,28 @@
 #include  "account.h"
 
-// For the setters we can use += and for deposit the argument is positive, 
-// for withdraw the argument is negative and the logic still holds.
+Account::Account(int id, const string &pass, atomic<uint64_t> *balances)
+    : id(id), password(pass), balances(balances) {
+  lock.instrument_as(INST_LOCK_ACCOUNT);
+}
+
+int Account::get_balance(Currency curr) const {
+  int balance[NUM_CURRENCIES];
+  get_balances(balance);
+  return balance[curr];
+}
 
-void Account::set_ils_balance(int new_ils) {
-  ils_blc += new_ils;
+// For deposit the argument is positive, for withdraw the argument is
+// negative and the logic still holds.
+void Account::add_balance(Currency curr, int amount) {
+  int balance[NUM_CURRENCIES];
+  update_balances([curr, amount](int *b) {
+    b[curr] += amount;
+    return true;
+  }, balance);
 }
 
-void Account::set_usd_balance(int new_usd) {
-  usd_blc += new_usd;
-}
\ No newline at end of file
+// Rollback - the account keeps its identity (and lock), only its data changes
+void Account::restore(const string &pass, const int *balance) {
+  password = pass;
+  balances->store(pack(balance));
+}
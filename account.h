@@ -1,31 +1,82 @@
 #ifndef ACCOUNT_H
 #define ACCOUNT_H
 
+#include "currency.h"
 #include "reader_writer.h"
+#include <atomic>
 #include <pthread.h>
+#include <stdint.h>
 #include <string>
 
 using namespace std;
 
+// Both balances live in one 64-bit word (ILS in the low half, USD in the
+// high half), so single-account operations are a CAS loop on that word
+// instead of a lock, and a reader always sees a matching ILS/USD pair.
+// The word itself sits in the AccountTable slab next to the other accounts'
+// words, the Account only points at it.
+static_assert(NUM_CURRENCIES == 2, "balances are packed two per word");
+
 class Account {
 private:
   int id;
   string password;
-  int ils_blc;
-  int usd_blc;
+  atomic<uint64_t> *balances; // slot in the AccountTable slab
 
 public:
+  // Only multi-account operations (transfer) take it, to move money between
+  // accounts as one step. Single-account updates go through update_balances.
   ReadWriteLock lock;
-  Account(int id, string pass, int ils_b, int usd_b)
-      : id(id), password(pass), ils_blc(ils_b), usd_blc(usd_b){};
+
+  // Built in place by AccountTable::insert, with the balances already set
+  Account(int id, const string &pass, atomic<uint64_t> *balances);
   int get_id() const { return id; }
-  string get_password() { return password; }
-  int get_ils_balance() { return ils_blc; }
-  int get_usd_balance() { return usd_blc; }
+  const string &get_password() const { return password; }
+  void get_balances(int *balance) const { unpack(balances->load(), balance); }
+  int get_balance(Currency curr) const;
+  int get_ils_balance() const { return get_balance(CURR_ILS); }
+  int get_usd_balance() const { return get_balance(CURR_USD); }
   // bool get_is_vip() const { return is_vip; }
 
-  void set_ils_balance(int new_ils);
-  void set_usd_balance(int new_usd);
+  // Runs change(balance) on a copy of the balances and publishes the result
+  // with one CAS, running it again if another thread got in first. If change
+  // returns false the account is left as is. Either way balance holds the
+  // balances the account ended up with.
+  template <typename Change> bool update_balances(Change change, int *balance) {
+    return update_word(*balances, change, balance);
+  }
+
+  void add_balance(Currency curr, int amount);
+  void restore(const string &pass, const int *balance); // rollback
+
+  static uint64_t pack(const int *balance) {
+    return (uint64_t)(uint32_t)balance[CURR_ILS] |
+           ((uint64_t)(uint32_t)balance[CURR_USD] << 32);
+  }
+  static void unpack(uint64_t word, int *balance) {
+    balance[CURR_ILS] = (int)(uint32_t)word;
+    balance[CURR_USD] = (int)(uint32_t)(word >> 32);
+  }
+
+  // The CAS loop behind update_balances, also used by the table sweeps
+  template <typename Change>
+  static bool update_word(atomic<uint64_t> &word, Change change, int *balance);
 };
 
+template <typename Change>
+bool Account::update_word(atomic<uint64_t> &word, Change change, int *balance) {
+  uint64_t current = word.load();
+  while (true) {
+    unpack(current, balance);
+    if (!change(balance)) {
+      unpack(current, balance);
+      return false;
+    }
+    if (word.compare_exchange_weak(current, pack(balance))) {
+      return true;
+    }
+    // current now holds the balances that beat us, try again on top of them
+  }
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,181 @@
+#include "account_table.h"
+#include <new>
+
+AccountTable::AccountTable() {
+  for (int i = 0; i < ACCOUNT_SHARDS; i++) {
+    shards[i].lock.instrument_as(INST_LOCK_SHARD);
+    shards[i].used_slots = 0;
+  }
+}
+
+AccountTable::~AccountTable() { clear(); }
+
+// Fibonacci hashing - consecutive ids spread over all shards
+int AccountTable::shard_of(int account_id) {
+  return (int)(((unsigned int)account_id * 2654435769u) >>
+               (32 - ACCOUNT_SHARD_BITS));
+}
+
+// Which shards the ids live in
+static void shards_of(const vector<int> &ids, bool *used) {
+  for (int i = 0; i < ACCOUNT_SHARDS; i++) {
+    used[i] = false;
+  }
+  for (int id : ids) {
+    used[AccountTable::shard_of(id)] = true;
+  }
+}
+
+void AccountTable::read_lock_set(const vector<int> &ids) {
+  bool used[ACCOUNT_SHARDS];
+  shards_of(ids, used);
+  for (int i = 0; i < ACCOUNT_SHARDS; i++) { // never the same shard twice
+    if (used[i]) {
+      shards[i].lock.readLock();
+    }
+  }
+}
+
+void AccountTable::read_unlock_set(const vector<int> &ids) {
+  bool used[ACCOUNT_SHARDS];
+  shards_of(ids, used);
+  for (int i = ACCOUNT_SHARDS - 1; i >= 0; i--) {
+    if (used[i]) {
+      shards[i].lock.readUnlock();
+    }
+  }
+}
+
+// Ids spread evenly over the shards, see shard_of()
+void AccountTable::reserve(int accounts) {
+  int per_shard = accounts / ACCOUNT_SHARDS + 1;
+  for (int i = 0; i < ACCOUNT_SHARDS; i++) {
+    shards[i].index.reserve(shards[i].index.size() + per_shard);
+    shards[i].chunks.reserve(shards[i].chunks.size() + per_shard / ACCOUNT_CHUNK + 1);
+  }
+}
+
+Account *AccountTable::find(int account_id) {
+  Shard &shard = shards[shard_of(account_id)];
+  auto it = shard.index.find(account_id);
+  if (it == shard.index.end()) {
+    return nullptr;
+  }
+  return chunk_of(shard, it->second).accounts[it->second & (ACCOUNT_CHUNK - 1)];
+}
+
+Account *AccountTable::insert(int account_id, const string &pass,
+                              const int *balance) {
+  Shard &shard = shards[shard_of(account_id)];
+  if (shard.index.count(account_id) > 0) {
+    return nullptr;
+  }
+
+  int slot;
+  if (!shard.free_slots.empty()) {
+    slot = shard.free_slots.back();
+    shard.free_slots.pop_back();
+  } else {
+    slot = shard.used_slots++;
+    if ((slot & (ACCOUNT_CHUNK - 1)) == 0) { // first slot of a new chunk
+      Chunk *chunk = new Chunk;
+      for (int i = 0; i < ACCOUNT_CHUNK; i++) {
+        chunk->balances[i].store(0);
+        chunk->snap_balances[i] = 0;
+        chunk->accounts[i] = nullptr;
+      }
+      shard.chunks.push_back(chunk);
+    }
+  }
+
+  Chunk &chunk = chunk_of(shard, slot);
+  int i = slot & (ACCOUNT_CHUNK - 1);
+  chunk.balances[i].store(Account::pack(balance));
+  chunk.snap_balances[i] = ~Account::pack(balance); // not in a snapshot yet
+  chunk.ids[i] = account_id;
+  chunk.accounts[i] = new (&chunk.storage[i]) Account(account_id, pass,
+                                                      &chunk.balances[i]);
+  shard.index[account_id] = slot;
+  return chunk.accounts[i];
+}
+
+// Destroys the account, the shard write lock keeps every other user out
+bool AccountTable::erase(int account_id) {
+  Shard &shard = shards[shard_of(account_id)];
+  auto it = shard.index.find(account_id);
+  if (it == shard.index.end()) {
+    return false;
+  }
+  int slot = it->second;
+  Chunk &chunk = chunk_of(shard, slot);
+  int i = slot & (ACCOUNT_CHUNK - 1);
+
+  chunk.accounts[i]->~Account();
+  chunk.accounts[i] = nullptr;
+  chunk.balances[i].store(0); // free slots look unchanged to the sweeps
+  chunk.snap_balances[i] = 0;
+  shard.index.erase(it);
+  shard.free_slots.push_back(slot);
+  shard.removed.push_back(account_id);
+  return true;
+}
+
+void AccountTable::changed_ids(int shard, vector<int> &out) {
+  Shard &s = shards[shard];
+  uint64_t words[ACCOUNT_CHUNK];
+  int changed[ACCOUNT_CHUNK];
+
+  for (int c = 0; c < (int)s.chunks.size(); c++) {
+    Chunk &chunk = *s.chunks[c];
+    int n = chunk_used(s, c);
+    load_balances(chunk, n, words);
+
+    int count = changed_words(words, chunk.snap_balances, n, changed);
+    for (int k = 0; k < count; k++) {
+      if (chunk.accounts[changed[k]] != nullptr) {
+        out.push_back(chunk.ids[changed[k]]);
+      }
+    }
+  }
+}
+
+void AccountTable::mark_snapshot(int account_id) {
+  Shard &shard = shards[shard_of(account_id)];
+  auto it = shard.index.find(account_id);
+  if (it != shard.index.end()) {
+    Chunk &chunk = chunk_of(shard, it->second);
+    int i = it->second & (ACCOUNT_CHUNK - 1);
+    chunk.snap_balances[i] = chunk.balances[i].load();
+  }
+}
+
+void AccountTable::take_removed(int shard, vector<int> &out) {
+  vector<int> &removed = shards[shard].removed;
+  out.insert(out.end(), removed.begin(), removed.end());
+  removed.clear();
+}
+
+void AccountTable::discard_removed() {
+  for (int i = 0; i < ACCOUNT_SHARDS; i++) {
+    shards[i].removed.clear();
+  }
+}
+
+void AccountTable::clear() {
+  for (int i = 0; i < ACCOUNT_SHARDS; i++) {
+    Shard &shard = shards[i];
+    for (Chunk *chunk : shard.chunks) {
+      for (int slot = 0; slot < ACCOUNT_CHUNK; slot++) {
+        if (chunk->accounts[slot] != nullptr) {
+          chunk->accounts[slot]->~Account();
+        }
+      }
+      delete chunk;
+    }
+    shard.chunks.clear();
+    shard.index.clear();
+    shard.free_slots.clear();
+    shard.used_slots = 0;
+    shard.removed.clear();
+  }
+}
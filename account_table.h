@@ -0,0 +1,209 @@
+#ifndef ACCOUNT_TABLE_H
+#define ACCOUNT_TABLE_H
+
+#include "account.h"
+#include "balance_kernels.h"
+#include "reader_writer.h"
+#include <atomic>
+#include <stdint.h>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+#define ACCOUNT_SHARD_BITS 6
+#define ACCOUNT_SHARDS (1 << ACCOUNT_SHARD_BITS)
+
+#define ACCOUNT_CHUNK_BITS 7
+#define ACCOUNT_CHUNK (1 << ACCOUNT_CHUNK_BITS) // slots per slab chunk
+
+// Concurrent table of accounts keyed by id.
+// The table is split into shards, each with its own lock, so opening or
+// closing an account only blocks threads that touch the same shard.
+// Lookups and updates must be done while holding the lock of the shard that
+// owns the id (read for lookups, write for insert/erase).
+//
+// Each shard stores its accounts in a slab of fixed size chunks, indexed by
+// slot, with an id -> slot index on the side. Within a chunk the fields the
+// sweeps read (balance words, snapshot words, ids) are separate arrays, so a
+// snapshot or commission sweep scans them sequentially, a chunk at a time
+// through the vector kernels of balance_kernels.h, and only touches an
+// Account object when it has to. Chunks never move, so an Account and its
+// balance word keep their address until the account is erased; freed slots
+// are reused by later inserts.
+class AccountTable {
+private:
+  typedef struct Chunk {
+    // hot - scanned by the sweeps
+    atomic<uint64_t> balances[ACCOUNT_CHUNK];
+    // as of the last snapshot - the bitwise complement of the balances for
+    // accounts not in a snapshot yet, 0 (like the balance word) in free slots
+    uint64_t snap_balances[ACCOUNT_CHUNK];
+    int ids[ACCOUNT_CHUNK];
+    Account *accounts[ACCOUNT_CHUNK]; // nullptr - free slot
+
+    // cold - the Accounts themselves, built in place
+    aligned_storage<sizeof(Account), alignof(Account)>::type storage[ACCOUNT_CHUNK];
+  } Chunk;
+
+  typedef struct Shard {
+    ReadWriteLock lock;
+    unordered_map<int, int> index; // id -> slot
+    vector<Chunk *> chunks;
+    vector<int> free_slots;
+    int used_slots; // slots ever handed out, sweeps stop here
+    vector<int> removed; // ids erased since the last take_removed()
+  } Shard;
+
+  Shard shards[ACCOUNT_SHARDS];
+
+  static Chunk &chunk_of(Shard &shard, int slot) {
+    return *shard.chunks[slot >> ACCOUNT_CHUNK_BITS];
+  }
+
+  // Slots of chunk c that were ever handed out
+  static int chunk_used(const Shard &shard, int c) {
+    int used = shard.used_slots - (c << ACCOUNT_CHUNK_BITS);
+    return used < ACCOUNT_CHUNK ? used : ACCOUNT_CHUNK;
+  }
+
+  // One pass of loads over the chunk's balance words
+  static void load_balances(const Chunk &chunk, int n, uint64_t *words) {
+    for (int i = 0; i < n; i++) {
+      words[i] = chunk.balances[i].load(memory_order_relaxed);
+    }
+  }
+
+public:
+  AccountTable();
+  ~AccountTable();
+
+  static int shard_of(int account_id);
+
+  // Per account locking - lock the shard that owns the id
+  void read_lock(int account_id) { shards[shard_of(account_id)].lock.readLock(); }
+  void read_unlock(int account_id) { shards[shard_of(account_id)].lock.readUnlock(); }
+  void write_lock(int account_id) { shards[shard_of(account_id)].lock.writeLock(); }
+  void write_unlock(int account_id) { shards[shard_of(account_id)].lock.writeUnlock(); }
+
+  // Any number of accounts - shards are taken once each, in shard order
+  void read_lock_set(const vector<int> &ids);
+  void read_unlock_set(const vector<int> &ids);
+
+  // Per shard access for sweeps over all accounts
+  void lock_shard_read(int shard) { shards[shard].lock.readLock(); }
+  void unlock_shard_read(int shard) { shards[shard].lock.readUnlock(); }
+  void lock_shard_write(int shard) { shards[shard].lock.writeLock(); }
+  void unlock_shard_write(int shard) { shards[shard].lock.writeUnlock(); }
+
+  // Room for this many accounts in total, before a bulk load
+  void reserve(int accounts);
+
+  // Caller holds the relevant shard lock
+  Account *find(int account_id);
+  Account *insert(int account_id, const string &pass, const int *balance); // nullptr if taken
+  bool erase(int account_id);
+
+  // Snapshot bookkeeping, for the bank thread and rollback.
+  // Calls visit(account, balance) for every account of the shard that was
+  // opened or whose balances moved since the last call, and records the
+  // balances it was given as the new snapshot state. Caller holds the shard
+  // lock and is the only one taking snapshots.
+  template <typename Visit> void snapshot_shard(int shard, Visit visit);
+  // Calls visit(account, balance word) for every account of the shard.
+  // Caller holds the shard lock.
+  template <typename Visit> void for_each_in_shard(int shard, Visit visit);
+  // Same test as snapshot_shard without recording anything, appends the ids
+  void changed_ids(int shard, vector<int> &out);
+  void mark_snapshot(int account_id); // current balances are the snapshot
+
+  // Takes percentage % of both balances of every account of the shard and
+  // calls done(id, commission) for each. The new balances are computed for
+  // the whole chunk at once and published with one CAS per account; an
+  // account that moved in between is charged again through
+  // Account::update_word. Caller holds the shard lock.
+  template <typename Done> void commission_shard(int shard, int percentage, Done done);
+
+  // Hands over the ids erased from the shard since the last call.
+  // Caller holds the shard lock and is the only one draining it.
+  void take_removed(int shard, vector<int> &out);
+  void discard_removed();
+
+  // Caller must have exclusive access to the whole table
+  void clear();
+};
+
+template <typename Visit> void AccountTable::snapshot_shard(int shard, Visit visit) {
+  Shard &s = shards[shard];
+  uint64_t words[ACCOUNT_CHUNK];
+  int changed[ACCOUNT_CHUNK];
+  int balance[NUM_CURRENCIES];
+
+  for (int c = 0; c < (int)s.chunks.size(); c++) {
+    Chunk &chunk = *s.chunks[c];
+    int n = chunk_used(s, c);
+    load_balances(chunk, n, words); // one read, copy and mark agree
+
+    int count = changed_words(words, chunk.snap_balances, n, changed);
+    for (int k = 0; k < count; k++) {
+      int i = changed[k];
+      if (chunk.accounts[i] == nullptr) {
+        continue;
+      }
+      chunk.snap_balances[i] = words[i];
+      Account::unpack(words[i], balance);
+      visit(*chunk.accounts[i], balance);
+    }
+  }
+}
+
+template <typename Visit> void AccountTable::for_each_in_shard(int shard, Visit visit) {
+  Shard &s = shards[shard];
+  for (int slot = 0; slot < s.used_slots; slot++) {
+    Chunk &chunk = chunk_of(s, slot);
+    int i = slot & (ACCOUNT_CHUNK - 1);
+    if (chunk.accounts[i] != nullptr) {
+      visit((const Account &)*chunk.accounts[i], chunk.balances[i].load());
+    }
+  }
+}
+
+template <typename Done>
+void AccountTable::commission_shard(int shard, int percentage, Done done) {
+  Shard &s = shards[shard];
+  uint64_t words[ACCOUNT_CHUNK];
+  uint64_t commission[ACCOUNT_CHUNK];
+  uint64_t after[ACCOUNT_CHUNK];
+  int taken[NUM_CURRENCIES];
+  int balance[NUM_CURRENCIES];
+
+  for (int c = 0; c < (int)s.chunks.size(); c++) {
+    Chunk &chunk = *s.chunks[c];
+    int n = chunk_used(s, c);
+    load_balances(chunk, n, words);
+    commission_words(words, n, percentage, commission, after);
+
+    for (int i = 0; i < n; i++) {
+      if (chunk.accounts[i] == nullptr) {
+        continue;
+      }
+      uint64_t expected = words[i];
+      if (chunk.balances[i].compare_exchange_strong(expected, after[i])) {
+        Account::unpack(commission[i], taken);
+      } else { // a deposit or the like got in first
+        Account::update_word(chunk.balances[i], [&](int *b) {
+          for (int curr = 0; curr < NUM_CURRENCIES; curr++) {
+            taken[curr] = balance_commission(b[curr], percentage);
+            b[curr] -= taken[curr];
+          }
+          return true;
+        }, balance);
+      }
+      done(chunk.ids[i], (const int *)taken);
+    }
+  }
+}
+
+#endif
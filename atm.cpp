@@ -1,29 +1,118 @@
 #include "atm.h"
+#include "instrument.h"
 #include "log.h"
 #include <fstream>
 #include <iostream>
-#include <sstream>
 #include <string>
 #include <unistd.h>
 #include <cmath>
 
+#ifndef ATM_TASK_COMMANDS
+#define ATM_TASK_COMMANDS 16 // commands per step before the other ATMs get a turn
+#endif
 
-#define RATE 5 // 1 USD = 5 ILS
+// Log lines the func_* commands and run_account_batch() have in common
+static string balances_text(const int *balance) {
+  return to_string(balance[CURR_ILS]) + " ILS and " +
+         to_string(balance[CURR_USD]) + " USD";
+}
 
-void *run_atm(void *arg) { 
-  ATM *atm = (ATM *)arg;
-  if (!atm)
-    return NULL;
+static string no_account_msg(int atm_id, int acc) {
+  return "Error " + to_string(atm_id) + ": Your transaction failed - account id " +
+         to_string(acc) + " does not exist";
+}
 
-  atm->bank_ptr->add_atm(atm); // atm asks bank to register it
+static string wrong_password_msg(int atm_id, int acc) {
+  return "Error " + to_string(atm_id) +
+         ": Your transaction failed - password for account id " +
+         to_string(acc) + " is incorrect";
+}
 
-  atm->input_file.open(atm->input_file_path);
-  if (!atm->input_file.is_open())
-    return NULL;
+static string not_covered_msg(int atm_id, int acc, const int *balance,
+                              int amount, Currency curr) {
+  return "Error " + to_string(atm_id) + ": Your transaction failed - account id " +
+         to_string(acc) + " balance is " + balances_text(balance) +
+         " is lower than " + to_string(amount) + " " + currency_name(curr);
+}
+
+static string balance_msg(int atm_id, int acc, const int *balance) {
+  return to_string(atm_id) + ": Account " + to_string(acc) + " balance is " +
+         balances_text(balance);
+}
+
+// action - "deposited", "withdrawn" or "exchanged"
+static string new_balance_msg(int atm_id, int acc, const int *balance,
+                              int amount, Currency curr, const char *action) {
+  return to_string(atm_id) + ": Account " + to_string(acc) + " new balance is " +
+         balances_text(balance) + " after " + to_string(amount) + " " +
+         currency_name(curr) + " was " + action;
+}
+
+// Runs the most urgent VIP command waiting at the time
+static void run_vip_task(Bank *bank) {
+  Command cmd;
+  if (!bank->take_vip_command(cmd)) {
+    return;
+  }
+  ATM *atm = bank->get_atm(cmd.atm_id);
+  if (atm) {
+    atm->run_command(cmd);
+  }
+}
+
+// The ATM's next command, false at the end of its file
+static bool next_command(ATM *atm, Command &cmd) {
+  if (atm->has_held) {
+    cmd = atm->held;
+    atm->has_held = false;
+    return true;
+  }
 
-  string line;
+  const char *line;
+  size_t len;
+  if (!atm->input_file.next_line(line, len)) {
+    return false;
+  }
+  cmd = atm->parse_command(line, len);
+  cmd.atm_id = atm->get_id(); // used so the vip task knows which atm to run the command on
+  return true;
+}
+
+static bool is_batchable(const Command &cmd) {
+  if (cmd.vip_priority > 0) {
+    return false;
+  }
+  return cmd.type == CMD_DEPOSIT || cmd.type == CMD_WITHDRAW ||
+         cmd.type == CMD_BALANCE || cmd.type == CMD_EXCHANGE;
+}
+
+// Reads the commands after first that belong to its run on the same
+// account, holds back the one that ends it. Returns the run's length.
+static int read_batch(ATM *atm, const Command &first, Command *batch) {
+  batch[0] = first;
+  int count = 1;
+  Command cmd;
+  while (count < ATM_BATCH_COMMANDS && next_command(atm, cmd)) {
+    if (!is_batchable(cmd) || cmd.account != first.account) {
+      atm->held = cmd;
+      atm->has_held = true;
+      break;
+    }
+    batch[count++] = cmd;
+  }
+  return count;
+}
+
+static void run_atm_step(ATM *atm, Executor *executor) {
+  for (int i = 0; i < ATM_TASK_COMMANDS; i++) {
+    long long on_break = atm->resume_at_us.load() - TimerQueue::now_us();
+    if (on_break > 0) {
+      // scheduled break (S command) - the worker runs other ATMs meanwhile
+      executor->submit_after((int)((on_break + 999) / 1000),
+                             [atm, executor]() { run_atm_step(atm, executor); });
+      return;
+    }
 
-  while (atm->is_running) {
     if (!atm->bank_ptr->is_atm_connected(atm->get_id())) {
       atm->is_running = false; //atm closed
       break;
@@ -31,129 +120,96 @@ void *run_atm(void *arg) {
 
     Command cmd;
 
-    if (!getline(atm->input_file, line)) {
+    if (!next_command(atm, cmd)) {
       atm->is_running = false; // atm finished
       break;
     }
-    cmd = atm->parse_command(line);
-    cmd.atm_id = atm->get_id(); // used so the vip thread knows which atm to run the command on
 
     if (cmd.vip_priority > 0) {
-      atm->bank_ptr->add_vip_command(cmd);
+      Bank *bank = atm->bank_ptr;
+      bank->add_vip_command(cmd);
+      executor->submit_urgent([bank]() { run_vip_task(bank); });
       continue;
     }
+
+    // a run on one account goes in one step - as if a close of this ATM or
+    // a break came in after its last command
+    if (is_batchable(cmd)) {
+      Command batch[ATM_BATCH_COMMANDS];
+      int count = read_batch(atm, cmd, batch);
+      if (count > 1) {
+        atm->run_account_batch(batch, count);
+        i += count - 1;
+        continue;
+      }
+    }
     atm->run_command(cmd);
-    // usleep(1000000); // sleep for 1 second between commands (debugging print_status)
   }
 
-  if (atm->input_file.is_open()) {
+  if (atm->is_running) {
+    executor->submit([atm, executor]() { run_atm_step(atm, executor); });
+  } else if (atm->input_file.is_open()) {
     atm->input_file.close();
   }
-  // write to log
-
-  return NULL;
 }
 
-Command ATM::parse_command(const string &line) {
-  Command cmd;
-  stringstream ss(line);
-  char cmd_type_char;
-
-  ss >> cmd_type_char;
-
-  switch (cmd_type_char) {
-  case 'O':
-    cmd.type = CMD_OPEN;
-    break;
-  case 'D':
-    cmd.type = CMD_DEPOSIT;
-    break;
-  case 'W':
-    cmd.type = CMD_WITHDRAW;
-    break;
-  case 'B':
-    cmd.type = CMD_BALANCE;
-    break;
-  case 'Q':
-    cmd.type = CMD_CLOSE;
-    break;
-  case 'T':
-    cmd.type = CMD_TRANSFER;
-    break;
-  case 'C':
-    cmd.type = CMD_CLOSE_ATM;
-    break;
-  case 'R':
-    cmd.type = CMD_ROLLBACK;
-    break;
-  case 'X':
-    cmd.type = CMD_EXCHANGE;
-    break;
-  case 'I':
-    cmd.type = CMD_INVEST;
-    break;
-  case 'S':
-    cmd.type = CMD_SLEEP;
-    break;
-  default:
-    cmd.type = CMD_OPEN;
-    break; // error handling
-  }
-
-  // get command string without type
-  if (line.length() > 1)
-    cmd.cmd_string = line.substr(1);
-  else
-    cmd.cmd_string = "";
-
-  cmd.vip_priority = 0; // vip is between (1,100)
+void start_atm(ATM *atm, Executor *executor) {
+  atm->bank_ptr->add_atm(atm); // atm asks bank to register it
 
-  string arg;
-  while (ss >> arg) {
-    // Check for VIP
-    if (arg.find("VIP=") == 0) {
-      cmd.vip_priority = stoi(arg.substr(4));
-    }
+  atm->input_file.open(atm->input_file_path);
+  if (!atm->input_file.is_open()) {
+    atm->is_running = false;
+    return;
   }
+  executor->submit([atm, executor]() { run_atm_step(atm, executor); });
+}
 
+Command ATM::parse_command(const char *line, size_t len) {
+  Command cmd;
+  ::parse_command(line, len, cmd);
   return cmd;
 }
 
 bool ATM::run_command(const Command &cmd) {
+  if (cmd.type == CMD_INVALID) {
+    cerr << "Bank error: illegal arguments" << endl;
+    return COMMAND_FAILED;
+  }
+  INST_COMMAND(cmd.type);
   int status;
   switch (cmd.type) {
   case (CMD_OPEN):
-    status = open_account(cmd.cmd_string);
+    status = open_account(cmd);
     break;
   case (CMD_DEPOSIT):
-    status = deposit(cmd.cmd_string);
+    status = deposit(cmd);
     break;
   case (CMD_WITHDRAW):
-    status = withdraw(cmd.cmd_string);
+    status = withdraw(cmd);
     break;
   case (CMD_BALANCE):
-    status = balance(cmd.cmd_string);
+    status = balance(cmd);
     break;
   case (CMD_CLOSE):
-    status = close_account(cmd.cmd_string);
+    status = close_account(cmd);
     break;
   case (CMD_TRANSFER):
-    status = transfer(cmd.cmd_string);
+    status = transfer(cmd);
     break;
   case (CMD_CLOSE_ATM):
-    status = close_atm(cmd.cmd_string);
+    status = close_atm(cmd);
     break;
   case (CMD_ROLLBACK):
-    status = rollback(cmd.cmd_string);
+    status = rollback(cmd);
     break;
   case (CMD_EXCHANGE):
-    status = exchange(cmd.cmd_string);
+    status = exchange(cmd);
     break;
   case (CMD_INVEST):
-    status = invest(cmd.cmd_string);
+    status = invest(cmd);
     break;
   case (CMD_SLEEP):
-    status = sleep(cmd.cmd_string);
+    status = sleep(cmd);
     break;
   default:
     status = COMMAND_FAILED;
@@ -162,82 +218,157 @@ bool ATM::run_command(const Command &cmd) {
   return status;
 }
 
-// Wrapper implementations
-// Wrappers parse arguments and call the actual function
-int ATM::open_account(const string &args) {
-  stringstream ss(args);
-  int account;
-  string password;
-  int amount_ils;
-  int amount_usd;
-  ss >> account >> password >> amount_ils >> amount_usd;
-
-  return func_open_account(account, password, amount_ils, amount_usd);
-}
-
-int ATM::deposit(const string &args) {
-  stringstream ss(args);
-  int account;
-  string password;
-  int amount;
-  string currency;
+// The checks and changes of func_deposit, func_withdraw, func_balance and
+// func_exchange, run over the whole batch in one balance update under one
+// lock of the account, with one journal frame for its changes
+void ATM::run_account_batch(const Command *cmds, int count) {
+  int acc = cmds[0].account;
+  bool valid[ATM_BATCH_COMMANDS];    // account exists, password is right
+  bool applied[ATM_BATCH_COMMANDS];  // balance covered it
+  int converted[ATM_BATCH_COMMANDS]; // exchanges
+  int after[ATM_BATCH_COMMANDS][NUM_CURRENCIES];
+
+  INST_BATCH_BEGIN();
+  for (int i = 0; i < count; i++) {
+    converted[i] = cmds[i].type == CMD_EXCHANGE
+                       ? convert_currency(cmds[i].amount, cmds[i].currency,
+                                          cmds[i].target_currency)
+                       : 0;
+  }
+
+  bank_ptr->lock_account_read(acc);
+  Account *account = this->get_bank_ptr()->get_account(acc);
 
-  ss >> account >> password >> amount >> currency;
+  for (int i = 0; i < count; i++) {
+    valid[i] = account != nullptr && account->get_password() == cmds[i].password;
+  }
+
+  // replays the batch on top of whatever another thread published first
+  int balance[NUM_CURRENCIES];
+  bool changed = account != nullptr && account->update_balances([&](int *b) {
+    bool any = false;
+    for (int i = 0; i < count; i++) {
+      applied[i] = false;
+      if (!valid[i]) {
+        continue;
+      }
+      const Command &cmd = cmds[i];
+      switch (cmd.type) {
+      case CMD_DEPOSIT:
+        b[cmd.currency] += cmd.amount;
+        applied[i] = true;
+        break;
+      case CMD_WITHDRAW:
+        if (b[cmd.currency] >= cmd.amount) {
+          b[cmd.currency] -= cmd.amount;
+          applied[i] = true;
+        }
+        break;
+      case CMD_EXCHANGE:
+        if (b[cmd.currency] >= cmd.amount) {
+          b[cmd.currency] -= cmd.amount;
+          b[cmd.target_currency] += converted[i];
+          applied[i] = true;
+        }
+        break;
+      default: // balance
+        applied[i] = true;
+        break;
+      }
+      any = any || (applied[i] && cmd.type != CMD_BALANCE);
+      after[i][CURR_ILS] = b[CURR_ILS];
+      after[i][CURR_USD] = b[CURR_USD];
+    }
+    return any;
+  }, balance);
+
+  if (changed && bank_ptr->get_journal().enabled()) {
+    JournalBatch records;
+    for (int i = 0; i < count; i++) {
+      const Command &cmd = cmds[i];
+      if (!applied[i] || cmd.type == CMD_BALANCE) {
+        continue;
+      }
+      int delta[NUM_CURRENCIES] = {0};
+      JournalOp op = JOURNAL_OP_DEPOSIT;
+      if (cmd.type == CMD_DEPOSIT) {
+        delta[cmd.currency] += cmd.amount;
+      } else if (cmd.type == CMD_WITHDRAW) {
+        delta[cmd.currency] -= cmd.amount;
+        op = JOURNAL_OP_WITHDRAW;
+      } else {
+        delta[cmd.currency] -= cmd.amount;
+        delta[cmd.target_currency] += converted[i];
+        op = JOURNAL_OP_EXCHANGE;
+      }
+      records.delta(op, acc, delta);
+    }
+    bank_ptr->get_journal().append(records);
+  }
+
+  bank_ptr->unlock_account_read(acc);
+
+  int id = this->get_id();
+  for (int i = 0; i < count; i++) {
+    const Command &cmd = cmds[i];
+    if (account == nullptr) {
+      Log::getInstance().write(no_account_msg(id, acc));
+    } else if (!valid[i]) {
+      // reported twice, like is_password_correct() and its callers do
+      string msg = wrong_password_msg(id, acc);
+      Log::getInstance().write(msg);
+      Log::getInstance().write(msg);
+    } else if (!applied[i]) {
+      Log::getInstance().write(not_covered_msg(id, acc, after[i], cmd.amount,
+                                               cmd.currency));
+    } else if (cmd.type == CMD_BALANCE) {
+      Log::getInstance().write(balance_msg(id, acc, after[i]));
+    } else {
+      const char *action = cmd.type == CMD_DEPOSIT    ? "deposited"
+                           : cmd.type == CMD_WITHDRAW ? "withdrawn"
+                                                      : "exchanged";
+      Log::getInstance().write(new_balance_msg(id, acc, after[i], cmd.amount,
+                                               cmd.currency, action));
+    }
+  }
 
-  return func_deposit(account, password, amount, currency);
+  INST_BATCH_END(count);
+  for (int i = 0; i < count; i++) {
+    INST_BATCH_COMMAND(cmds[i].type);
+  }
 }
 
-int ATM::withdraw(const string &args) {
-  stringstream ss(args);
-  int account;
-  string password;
-  int amount;
-  string currency;
-
-  ss >> account >> password >> amount >> currency;
-
-  return func_withdraw(account, password, amount, currency);
+// Wrapper implementations
+// Wrappers unpack the parsed arguments and call the actual function
+int ATM::open_account(const Command &cmd) {
+  return func_open_account(cmd.account, cmd.password, cmd.ils, cmd.usd);
 }
 
-int ATM::balance(const string &args) {
-  stringstream ss(args);
-  int account;
-  string password;
-
-  ss >> account >> password;
-
-  return func_balance(account, password);
+int ATM::deposit(const Command &cmd) {
+  return func_deposit(cmd.account, cmd.password, cmd.amount,
+                      cmd.currency);
 }
 
-int ATM::close_account(const string &args) {
-  stringstream ss(args);
-  int account;
-  string password;
-
-  ss >> account >> password;
-
-  return func_close_account(account, password);
+int ATM::withdraw(const Command &cmd) {
+  return func_withdraw(cmd.account, cmd.password, cmd.amount,
+                       cmd.currency);
 }
 
-int ATM::transfer(const string &args) {
-  stringstream ss(args);
-  int source_account;
-  string password;
-  int target_account;
-  int amount;
-  string currency;
-
-  ss >> source_account >> password >> target_account >> amount >> currency;
+int ATM::balance(const Command &cmd) {
+  return func_balance(cmd.account, cmd.password);
+}
 
-  return func_transfer(source_account, password, target_account, amount,
-                       currency);
+int ATM::close_account(const Command &cmd) {
+  return func_close_account(cmd.account, cmd.password);
 }
 
-int ATM::close_atm(const string &args) {
-  stringstream ss(args);
-  int target_atm;
+int ATM::transfer(const Command &cmd) {
+  return func_transfer(cmd.account, cmd.password, cmd.target, cmd.amount,
+                       cmd.currency);
+}
 
-  ss >> target_atm;
+int ATM::close_atm(const Command &cmd) {
+  int target_atm = cmd.target;
 
   if (target_atm > this->num_atms || target_atm <= 0) {
     string msg = "Error " + to_string(this->get_id()) +
@@ -251,65 +382,35 @@ int ATM::close_atm(const string &args) {
   return func_close_atm(target_atm);
 }
 
-int ATM::rollback(const string &args) {
-  stringstream ss(args);
-  int iterations;
-
-  ss >> iterations;
-
-  return func_rollback(iterations);
+int ATM::rollback(const Command &cmd) {
+  return func_rollback(cmd.amount);
 }
 
-int ATM::exchange(const string &args) {
-  stringstream ss(args);
-  int account;
-  string password;
-  string source_currency;
-  string target_currency;
-  string to_word;
-  int source_amount;
-
-  ss >> account >> password >> source_currency >> to_word >> target_currency >>
-      source_amount;
-
-  return func_exchange(account, password, source_currency, target_currency,
-                       source_amount);
+int ATM::exchange(const Command &cmd) {
+  return func_exchange(cmd.account, cmd.password, cmd.currency,
+                       cmd.target_currency, cmd.amount);
 }
 
-int ATM::invest(const string &args) {
-  stringstream ss(args);
-  int account;
-  string password;
-  int amount;
-  string currency;
-  int time;
-
-  ss >> account >> password >> amount >> currency >> time;
-
-
-  return func_invest(account, password, amount, currency, time);
+int ATM::invest(const Command &cmd) {
+  return func_invest(cmd.account, cmd.password, cmd.amount,
+                     cmd.currency, cmd.time);
 }
 
-int ATM::sleep(const string &args) { 
-  stringstream ss(args);
-  int sleep_time_in_ms;
-  ss >> sleep_time_in_ms;
-
-  return sleep_func(sleep_time_in_ms);
+int ATM::sleep(const Command &cmd) {
+  return sleep_func(cmd.time, cmd.vip_priority > 0);
 }
 
 // ----- Actual functions -----
 
-int ATM::func_open_account(int acc, string pswd, int ils, int usd) {
+int ATM::func_open_account(int acc, const char *pswd, int ils, int usd) {
   
-  Account *new_account = new Account(acc, pswd, ils, usd);
-  bool success_adding_account = this->get_bank_ptr()->add_account(new_account);
+  bool success_adding_account =
+      this->get_bank_ptr()->add_account(acc, pswd, ils, usd);
 
   if (!success_adding_account) {
     string msg = "Error " + to_string(this->get_id()) +
                  ": Your transaction failed - account with the same id exists";
     Log::getInstance().write(msg);
-    delete new_account; // free allocated memory
     return COMMAND_FAILED;
   }
 
@@ -321,201 +422,147 @@ int ATM::func_open_account(int acc, string pswd, int ils, int usd) {
   return COMMAND_SUCCESSFULL;
 }
 
-int ATM::func_deposit(int acc, string password, int amount, string curr) {
-  bank_ptr->lock_bank_read();
+int ATM::func_deposit(int acc, const char *password, int amount,
+                      Currency curr) {
+  bank_ptr->lock_account_read(acc);
 
   Account *account = this->get_bank_ptr()->get_account(acc);
 
   // Check if account doesn't exist
   if (account == nullptr) {
-    bank_ptr->unlock_bank_read();
-    string msg = "Error " + to_string(this->get_id()) +
-                 ": Your transaction failed - account id " + to_string(acc) +
-                 " does not exist";
-    Log::getInstance().write(msg);
+    bank_ptr->unlock_account_read(acc);
+    Log::getInstance().write(no_account_msg(this->get_id(), acc));
     return COMMAND_FAILED;
   }
 
   // check password
   if (!is_password_correct(acc, password)) {
-    string msg = "Error " + to_string(this->get_id()) +
-                 ": Your transaction failed - password for account id " +
-                 to_string(acc) + " is incorrect";
-    Log::getInstance().write(msg);
-    bank_ptr->unlock_bank_read();
+    Log::getInstance().write(wrong_password_msg(this->get_id(), acc));
+    bank_ptr->unlock_account_read(acc);
     return COMMAND_FAILED;
   }
 
-  account->lock.writeLock();
-
-  if (curr == "ILS") { // deposit ILS
-    account->set_ils_balance(amount);
-  } else { // deposit USD
-    account->set_usd_balance(amount);
-  }
-
-  int account_ils = account->get_ils_balance();
-  int account_usd = account->get_usd_balance();
+  int balance[NUM_CURRENCIES];
+  account->update_balances([curr, amount](int *b) {
+    b[curr] += amount;
+    return true;
+  }, balance);
+  bank_ptr->get_journal().delta(JOURNAL_OP_DEPOSIT, acc, curr, amount);
 
-  account->lock.writeUnlock();
-  bank_ptr->unlock_bank_read();
+  bank_ptr->unlock_account_read(acc);
 
-  string msg = to_string(this->get_id()) + ": Account " + to_string(acc) +
-               " new balance is " + to_string(account_ils) + " ILS and " +
-               to_string(account_usd) + " USD after " + to_string(amount) +
-               " " + curr + " was deposited";
-  Log::getInstance().write(msg);
+  Log::getInstance().write(new_balance_msg(this->get_id(), acc, balance, amount,
+                                           curr, "deposited"));
   return COMMAND_SUCCESSFULL;
 }
 
-int ATM::func_withdraw(int acc, string pswd, int amount, string curr) {
+int ATM::func_withdraw(int acc, const char *pswd, int amount,
+                       Currency curr) {
 
-  bank_ptr->lock_bank_read();
+  bank_ptr->lock_account_read(acc);
 
   Account *account = this->get_bank_ptr()->get_account(acc);
 
   // Check if account doesn't exist
   if (account == nullptr) {
-    bank_ptr->unlock_bank_read();
-    string msg = "Error " + to_string(this->get_id()) +
-                 ": Your transaction failed - account id " + to_string(acc) +
-                 " does not exist";
-    Log::getInstance().write(msg);
+    bank_ptr->unlock_account_read(acc);
+    Log::getInstance().write(no_account_msg(this->get_id(), acc));
     return COMMAND_FAILED;
   }
 
   // check password
   if (!is_password_correct(acc, pswd)) {
-    string msg = "Error " + to_string(this->get_id()) +
-                 ": Your transaction failed - password for account id " +
-                 to_string(acc) + " is incorrect";
-    Log::getInstance().write(msg);
-    bank_ptr->unlock_bank_read();
+    Log::getInstance().write(wrong_password_msg(this->get_id(), acc));
+    bank_ptr->unlock_account_read(acc);
     return COMMAND_FAILED;
   }
 
-  account->lock.writeLock();
-
-  int account_ils = account->get_ils_balance();
-  int account_usd = account->get_usd_balance();
+  // withdraw only if the balance covers it, checked on the value we replace
+  int balance[NUM_CURRENCIES];
+  bool covered = account->update_balances([curr, amount](int *b) {
+    if (b[curr] < amount) {
+      return false;
+    }
+    b[curr] -= amount;
+    return true;
+  }, balance);
 
   // If not enough relavent balance return error
-  if ((curr == "ILS" && account_ils < amount) ||
-      (curr == "USD" && account_usd < amount)) {
+  if (!covered) {
+    bank_ptr->unlock_account_read(acc);
 
-    account->lock.writeUnlock();
-    bank_ptr->unlock_bank_read();
-
-    string msg = "Error " + to_string(this->get_id()) +
-                 ": Your transaction failed - account id " + to_string(acc) +
-                 " balance is " + to_string(account_ils) + " ILS and " +
-                 to_string(account_usd) + " USD is lower than " +
-                 to_string(amount) + " " + curr;
-    Log::getInstance().write(msg);
+    Log::getInstance().write(not_covered_msg(this->get_id(), acc, balance,
+                                             amount, curr));
     return COMMAND_FAILED;
   }
 
-  // Otherwise withdraw accordingly
-  if (curr == "ILS") { // withdraw ILS
-    account->set_ils_balance(-amount);
-  } else { // withdraw USD
-    account->set_usd_balance(-amount);
-  }
-
-  account_ils = account->get_ils_balance();
-  account_usd = account->get_usd_balance();
+  bank_ptr->get_journal().delta(JOURNAL_OP_WITHDRAW, acc, curr, -amount);
+  bank_ptr->unlock_account_read(acc);
 
-  account->lock.writeUnlock();
-  bank_ptr->unlock_bank_read();
-
-  string msg = to_string(this->get_id()) + ": Account " + to_string(acc) +
-               " new balance is " + to_string(account_ils) + " ILS and " +
-               to_string(account_usd) + " USD after " + to_string(amount) +
-               " " + curr + " was withdrawn";
-  Log::getInstance().write(msg);
+  Log::getInstance().write(new_balance_msg(this->get_id(), acc, balance, amount,
+                                           curr, "withdrawn"));
   return COMMAND_SUCCESSFULL;
 }
 
-int ATM::func_balance(int acc, string pswd) {
-  bank_ptr->lock_bank_read();
+int ATM::func_balance(int acc, const char *pswd) {
+  bank_ptr->lock_account_read(acc);
 
   Account *account = this->get_bank_ptr()->get_account(acc);
 
   // Check if account doesn't exist
   if (account == nullptr) {
-    bank_ptr->unlock_bank_read();
-    string msg = "Error " + to_string(this->get_id()) +
-                 ": Your transaction failed - account id " + to_string(acc) +
-                 " does not exist";
-    Log::getInstance().write(msg);
+    bank_ptr->unlock_account_read(acc);
+    Log::getInstance().write(no_account_msg(this->get_id(), acc));
     return COMMAND_FAILED;
   }
 
   // check password
   if (!is_password_correct(acc, pswd)) {
-    string msg = "Error " + to_string(this->get_id()) +
-                 ": Your transaction failed - password for account id " +
-                 to_string(acc) + " is incorrect";
-    Log::getInstance().write(msg);
-    bank_ptr->unlock_bank_read();
+    Log::getInstance().write(wrong_password_msg(this->get_id(), acc));
+    bank_ptr->unlock_account_read(acc);
     return COMMAND_FAILED;
   }
 
-  account->lock.readLock();
+  int balance[NUM_CURRENCIES];
+  account->get_balances(balance); // one load, a matching ILS/USD pair
 
-  int account_ils = account->get_ils_balance();
-  int account_usd = account->get_usd_balance();
+  bank_ptr->unlock_account_read(acc);
 
-  account->lock.readUnlock();
-  bank_ptr->unlock_bank_read();
-
-  string msg = to_string(this->get_id()) + ": Account " + to_string(acc) +
-               " balance is " + to_string(account_ils) + " ILS and " +
-               to_string(account_usd) + " USD";
-  Log::getInstance().write(msg);
+  Log::getInstance().write(balance_msg(this->get_id(), acc, balance));
   return COMMAND_SUCCESSFULL;
 }
 
-int ATM::func_close_account(int acc, string pswd) {
-  bank_ptr->lock_bank_read();
+int ATM::func_close_account(int acc, const char *pswd) {
+  bank_ptr->lock_account_read(acc);
 
   Account *account = this->get_bank_ptr()->get_account(acc);
 
   // Check if account doesn't exist
   if (account == nullptr) {
-    bank_ptr->unlock_bank_read();
-    string msg = "Error " + to_string(this->get_id()) +
-                 ": Your transaction failed - account id " + to_string(acc) +
-                 " does not exist";
-    Log::getInstance().write(msg);
+    bank_ptr->unlock_account_read(acc);
+    Log::getInstance().write(no_account_msg(this->get_id(), acc));
     return COMMAND_FAILED;
   }
 
   // check password
   if (!is_password_correct(acc, pswd)) {
-    string msg = "Error " + to_string(this->get_id()) +
-                 ": Your transaction failed - password for account id " +
-                 to_string(acc) + " is incorrect";
-    Log::getInstance().write(msg);
-    bank_ptr->unlock_bank_read();
+    Log::getInstance().write(wrong_password_msg(this->get_id(), acc));
+    bank_ptr->unlock_account_read(acc);
     return COMMAND_FAILED;
   }
 
-  account->lock.readLock();
   // get final balance
-  int final_ils = account->get_ils_balance();
-  int final_usd = account->get_usd_balance();
+  int balance[NUM_CURRENCIES];
+  account->get_balances(balance);
+  int final_ils = balance[CURR_ILS];
+  int final_usd = balance[CURR_USD];
 
-  account->lock.readUnlock();
-  bank_ptr->unlock_bank_read();
+  bank_ptr->unlock_account_read(acc);
 
   // remove account from bank
   bool success = this->get_bank_ptr()->remove_account(acc);
   if (!success) {
-    string msg = "Error " + to_string(this->get_id()) +
-                 ": Your transaction failed - account id " + to_string(acc) +
-                 " does not exist";
-    Log::getInstance().write(msg);
+    Log::getInstance().write(no_account_msg(this->get_id(), acc));
     return COMMAND_FAILED;
   }
 
@@ -526,87 +573,64 @@ int ATM::func_close_account(int acc, string pswd) {
   return COMMAND_SUCCESSFULL;
 }
 
-int ATM::func_transfer(int s_acc, string pswd, int t_acc, int amount,
-                       string curr) {
-  bank_ptr->lock_bank_read();
+int ATM::func_transfer(int s_acc, const char *pswd, int t_acc, int amount,
+                       Currency curr) {
+  vector<int> locked = {s_acc, t_acc}; // once if they are the same account
+  bank_ptr->lock_accounts(locked);
 
   Account *source_account = this->get_bank_ptr()->get_account(s_acc);
   Account *target_account = this->get_bank_ptr()->get_account(t_acc);
 
   // Check if account doesn't exist
   if (source_account == nullptr) {
-    bank_ptr->unlock_bank_read();
-    string msg = "Error " + to_string(this->get_id()) +
-                 ": Your transaction failed - account id " + to_string(s_acc) +
-                 " does not exist";
-    Log::getInstance().write(msg);
+    bank_ptr->unlock_accounts(locked);
+    Log::getInstance().write(no_account_msg(this->get_id(), s_acc));
     return COMMAND_FAILED;
   }
   if (target_account == nullptr) {
-    bank_ptr->unlock_bank_read();
-    string msg = "Error " + to_string(this->get_id()) +
-                 ": Your transaction failed - account id " + to_string(t_acc) +
-                 " does not exist";
-    Log::getInstance().write(msg);
+    bank_ptr->unlock_accounts(locked);
+    Log::getInstance().write(no_account_msg(this->get_id(), t_acc));
     return COMMAND_FAILED;
   }
 
   // check password
   if (!is_password_correct(s_acc, pswd)) {
-    string msg = "Error " + to_string(this->get_id()) +
-                 ": Your transaction failed - password for account id " +
-                 to_string(s_acc) + " is incorrect";
-    Log::getInstance().write(msg);
-    bank_ptr->unlock_bank_read();
+    Log::getInstance().write(wrong_password_msg(this->get_id(), s_acc));
+    bank_ptr->unlock_accounts(locked);
     return COMMAND_FAILED;
   }
 
-  Account *first_lock = (s_acc < t_acc) ? source_account : target_account;
-  Account *second_lock = (s_acc < t_acc) ? target_account : source_account;
+  // debit the source, credit the target - both or neither
+  vector<BalanceDelta> deltas(2);
+  deltas[0].account = s_acc;
+  deltas[1].account = t_acc;
+  for (int c = 0; c < NUM_CURRENCIES; c++) {
+    deltas[0].amount[c] = c == curr ? -amount : 0;
+    deltas[1].amount[c] = c == curr ? amount : 0;
+  }
+  int failed;
+  TransactionStatus status =
+      bank_ptr->apply_deltas(deltas, JOURNAL_OP_TRANSFER, failed);
 
-  first_lock->lock.writeLock();
-  second_lock->lock.writeLock();
+  bank_ptr->unlock_accounts(locked);
 
   // If not enough relevant balance return error
-
-  int source_account_ils = source_account->get_ils_balance();
-  int source_account_usd = source_account->get_usd_balance();
-
-  if ((curr == "ILS" && source_account_ils < amount) ||
-      (curr == "USD" && source_account_usd < amount)) {
-
-    second_lock->lock.writeUnlock();
-    first_lock->lock.writeUnlock();
-    bank_ptr->unlock_bank_read();
-
+  if (status != TRANSACTION_DONE) {
     string msg = "Error " + to_string(this->get_id()) +
                  ": Your transaction failed - balance of account id " +
                  to_string(s_acc) + " is lower than " + to_string(amount) +
-                 " " + curr;
+                 " " + currency_name(curr);
     Log::getInstance().write(msg);
     return COMMAND_FAILED;
   }
 
-  // Otherwise transfer accordingly
-  if (curr == "ILS") { // transfer ILS
-    source_account->set_ils_balance(-amount);
-    target_account->set_ils_balance(amount);
-  } else { // transfer USD
-    source_account->set_usd_balance(-amount);
-    target_account->set_usd_balance(amount);
-  }
-
-  source_account_ils = source_account->get_ils_balance();
-  source_account_usd = source_account->get_usd_balance();
-  int target_account_ils = target_account->get_ils_balance();
-  int target_account_usd = target_account->get_usd_balance();
-
-  first_lock->lock.writeUnlock();
-  second_lock->lock.writeUnlock();
-  bank_ptr->unlock_bank_read();
+  int source_account_ils = deltas[0].balance[CURR_ILS];
+  int source_account_usd = deltas[0].balance[CURR_USD];
+  int target_account_ils = deltas[1].balance[CURR_ILS];
+  int target_account_usd = deltas[1].balance[CURR_USD];
 
   string msg = to_string(this->get_id()) + ": Transfer " + to_string(amount) +
-               " " + curr + " from account " + to_string(s_acc) +
+               " " + currency_name(curr) + " from account " + to_string(s_acc) +
                " to account " + to_string(t_acc) + " new account balance is " +
                to_string(source_account_ils) + " ILS and " +
                to_string(source_account_usd) + " USD " +
@@ -639,157 +663,131 @@ int ATM::func_rollback(int it) {
   return COMMAND_SUCCESSFULL; // for checks
 }
 
-int ATM::func_exchange(int acc, string pswd, string s_curr,
-                       string t_curr, int s_amount) {
+int ATM::func_exchange(int acc, const char *pswd, Currency s_curr,
+                       Currency t_curr, int s_amount) {
 
-  bank_ptr->lock_bank_read();
+  bank_ptr->lock_account_read(acc);
 
   Account *account = this->get_bank_ptr()->get_account(acc);
 
   // Check if account doesn't exist
   if (account == nullptr) {
-    bank_ptr->unlock_bank_read();
-    string msg = "Error " + to_string(this->get_id()) +
-                 ": Your transaction failed - account id " + to_string(acc) +
-                 " does not exist";
-    Log::getInstance().write(msg);
+    bank_ptr->unlock_account_read(acc);
+    Log::getInstance().write(no_account_msg(this->get_id(), acc));
     return COMMAND_FAILED;
   }
 
   // check password
   if (!is_password_correct(acc, pswd)) {
-    string msg = "Error " + to_string(this->get_id()) +
-                 ": Your transaction failed - password for account id " +
-                 to_string(acc) + " is incorrect";
-    Log::getInstance().write(msg);
-    bank_ptr->unlock_bank_read();
+    Log::getInstance().write(wrong_password_msg(this->get_id(), acc));
+    bank_ptr->unlock_account_read(acc);
     return COMMAND_FAILED;
   }
 
-  account->lock.writeLock();
-
-  // Account* account = atm->bank_ptr->get_account(acc);
-  // check if account have enough balance in source currency before exchange
-  if ((s_curr == "ILS" && account->get_ils_balance() < s_amount) ||
-      (s_curr == "USD" && account->get_usd_balance() < s_amount)) {
+  // check the source balance and move both currencies in one update
+  // (integer division, same currency is a no-op)
+  int converted = convert_currency(s_amount, s_curr, t_curr);
+  int balance[NUM_CURRENCIES];
+  bool covered = account->update_balances([&](int *b) {
+    if (b[s_curr] < s_amount) {
+      return false;
+    }
+    b[s_curr] -= s_amount;
+    b[t_curr] += converted;
+    return true;
+  }, balance);
 
-    account->lock.writeUnlock();
-    bank_ptr->unlock_bank_read();
+  if (!covered) {
+    bank_ptr->unlock_account_read(acc);
 
-    string msg = "Error " + to_string(this->get_id()) +
-                 ": Your transaction failed - account id " + to_string(acc) +
-                 " balance is " + to_string(account->get_ils_balance()) +
-                 " ILS and " + to_string(account->get_usd_balance()) + 
-                 " USD is lower than " + to_string(s_amount) + " " + s_curr;
-    Log::getInstance().write(msg);
+    Log::getInstance().write(not_covered_msg(this->get_id(), acc, balance,
+                                             s_amount, s_curr));
     return COMMAND_FAILED;
   }
 
-  // perform exchange 
-  if (s_curr == "ILS" && t_curr == "USD") {
-    account->set_ils_balance(-s_amount);
-    int t_amount = s_amount / RATE; // integer division
-    account->set_usd_balance(t_amount);
-  } else if (s_curr == "USD" && t_curr == "ILS") {
-    account->set_usd_balance(-s_amount);
-    int t_amount = s_amount * RATE;
-    account->set_ils_balance(t_amount);
-  }
-  int src_ils = account->get_ils_balance();
-  int src_usd =  account->get_usd_balance();
+  int delta[NUM_CURRENCIES] = {0};
+  delta[s_curr] -= s_amount;
+  delta[t_curr] += converted;
+  bank_ptr->get_journal().delta(JOURNAL_OP_EXCHANGE, acc, delta);
 
-  account->lock.writeUnlock();
-  bank_ptr->unlock_bank_read();
+  bank_ptr->unlock_account_read(acc);
   
-  string msg = to_string(this->get_id()) + ": Account " + to_string(acc) +
-               " new balance is " + to_string(src_ils) + " ILS and " +
-               to_string(src_usd) + " USD after " + to_string(s_amount) +
-               " " + s_curr + " was exchanged";
-  Log::getInstance().write(msg);
+  Log::getInstance().write(new_balance_msg(this->get_id(), acc, balance, s_amount,
+                                           s_curr, "exchanged"));
   
   return COMMAND_SUCCESSFULL; // for checks
 }
-int ATM::func_invest(int acc, string pswd, int amount, string curr, int time) {
-  bank_ptr->lock_bank_read();
+int ATM::func_invest(int acc, const char *pswd, int amount, Currency curr,
+                     int time) {
+  bank_ptr->lock_account_read(acc);
   Account *account = this->get_bank_ptr()->get_account(acc);
 
   if (account == nullptr) {
-    bank_ptr->unlock_bank_read();
-    string msg = "Error " + to_string(this->get_id()) +
-                 ": Your transaction failed - account id " + to_string(acc) +
-                 " does not exist";
-    Log::getInstance().write(msg);
+    bank_ptr->unlock_account_read(acc);
+    Log::getInstance().write(no_account_msg(this->get_id(), acc));
     return COMMAND_FAILED;
   }
 
   if (!is_password_correct(acc, pswd)) {
-    string msg = "Error " + to_string(this->get_id()) +
-                 ": Your transaction failed - password for account id " +
-                 to_string(acc) + " is incorrect";
-    Log::getInstance().write(msg);
-    bank_ptr->unlock_bank_read();
+    Log::getInstance().write(wrong_password_msg(this->get_id(), acc));
+    bank_ptr->unlock_account_read(acc);
     return COMMAND_FAILED;
   }
 
-  account->lock.writeLock();
-
-  int current_balance = (curr == "ILS") ? account->get_ils_balance() : account->get_usd_balance();
+  int balance[NUM_CURRENCIES];
+  bool covered = account->update_balances([curr, amount](int *b) {
+    if (b[curr] < amount) {
+      return false;
+    }
+    b[curr] -= amount;
+    return true;
+  }, balance);
+  int current_balance = balance[curr];
 
-  if (current_balance < amount) {
-    account->lock.writeUnlock();
-    bank_ptr->unlock_bank_read();
+  if (!covered) {
+    bank_ptr->unlock_account_read(acc);
     string msg = "Error " + to_string(this->get_id()) +
                  ": Your transaction failed - account id " + to_string(acc) +
-                 " balance is " + to_string(current_balance) + " " + curr + 
-                 " is lower than " + to_string(amount) + " " + curr;
+                 " balance is " + to_string(current_balance) + " " + currency_name(curr) + 
+                 " is lower than " + to_string(amount) + " " + currency_name(curr);
     Log::getInstance().write(msg);
     return COMMAND_FAILED;
   }
 
-  if (curr == "ILS") { //ILS
-    account->set_ils_balance(-amount);
-  } else {  //USD
-    account->set_usd_balance(-amount);
-  }
-
-  account->lock.writeUnlock(); // unlock to allow other operations during sleep
-  bank_ptr->unlock_bank_read();
-
-  usleep(time * 1000);
-
-  account->lock.writeLock(); // lock again to update balance after investment
-
-  double factor = pow(1.03, (double)time / 10.0); // 3% every 10 ms
-  int final_amount = (int)(amount * factor); // rounded down
-
-  if (curr == "ILS") {
-    account->set_ils_balance(final_amount);
-  } else {
-    account->set_usd_balance(final_amount);
-  }
-  account->lock.writeUnlock();
+  // journaled with the debit, the bank pays it back when it matures and
+  // the ATM moves on right away
+  bank_ptr->schedule_investment(acc, curr, amount, time);
+  bank_ptr->unlock_account_read(acc);
 
   return COMMAND_SUCCESSFULL;
 }
 
-int ATM::sleep_func(int sleep_time_in_ms) {
+int ATM::sleep_func(int sleep_time_in_ms, bool is_vip) {
   string msg = to_string(this->get_id()) + 
                 ": Currently on a scheduled break. Service will resume within " +
                 to_string(sleep_time_in_ms) + " ms.";
   Log::getInstance().write(msg);
 
-  usleep(sleep_time_in_ms * 1000);
+  if (is_vip) {
+    // a VIP break only holds its urgent lane, like the VIP threads did - the
+    // ATM's own commands go on meanwhile
+    usleep(sleep_time_in_ms * 1000);
+    return COMMAND_SUCCESSFULL;
+  }
+
+  // the ATM's task stream waits the break out before its next command
+  long long resume = TimerQueue::now_us() + (long long)sleep_time_in_ms * 1000;
+  if (resume > resume_at_us.load()) {
+    resume_at_us.store(resume);
+  }
 
   return COMMAND_SUCCESSFULL;
 }
 
-bool ATM::is_password_correct(int acc_id, string password) {
+bool ATM::is_password_correct(int acc_id, const char *password) {
 
   if (this->get_bank_ptr()->get_account(acc_id)->get_password() != password) {
-    string msg = "Error " + to_string(this->get_id()) +
-                 ": Your transaction failed - password for account id " +
-                 to_string(acc_id) + " is incorrect";
-    Log::getInstance().write(msg);
+    Log::getInstance().write(wrong_password_msg(this->get_id(), acc_id));
     return false;
   }
 
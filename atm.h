@@ -1,67 +1,81 @@
 #ifndef ATM_H
 #define ATM_H
 
+#include <atomic>
 #include <string>
 #include <fstream>
 #include <iostream>
 #include "bank.h"
 #include "command.h"
+#include "executor.h"
+#include "input_file.h"
 
 using namespace std;
 
+#ifndef ATM_BATCH_COMMANDS
+#define ATM_BATCH_COMMANDS 16 // longest run of same-account commands run as one
+#endif
+
 class ATM{
     public:
         int atm_id;
         string input_file_path; 
-        ifstream input_file;
+        InputFile input_file;
         Bank* bank_ptr;        
         bool is_running;
         int num_atms;
+        atomic<long long> resume_at_us; // end of the current break
+        Command held; // read ahead past a batch, runs next
+        bool has_held;
         
         ATM(int id, string& file_path, Bank* bank, int num_atms) : atm_id(id),
-        input_file_path(file_path), bank_ptr(bank), is_running(true), num_atms(num_atms){};
+        input_file_path(file_path), bank_ptr(bank), is_running(true), num_atms(num_atms),
+        resume_at_us(0), has_held(false){};
 
         
-        Command parse_command(const string& line);
+        Command parse_command(const char* line, size_t len);
         bool run_command(const Command& cmd);
+        // Deposits, withdrawals, balance checks and exchanges of one account,
+        // with the outcomes and log lines of running them one by one
+        void run_account_batch(const Command* cmds, int count);
         
         // Wrappers
-        int open_account(const string& args);
-        int deposit(const string& args);
-        int withdraw(const string& args);
-        int balance(const string& args);
-        int close_account(const string& args);
-        int transfer(const string& args);
-        int close_atm(const string& args);
-        int rollback(const string& args);
-        int exchange(const string& args);
-        int invest(const string& args);
-        int sleep(const string& args);
+        int open_account(const Command& cmd);
+        int deposit(const Command& cmd);
+        int withdraw(const Command& cmd);
+        int balance(const Command& cmd);
+        int close_account(const Command& cmd);
+        int transfer(const Command& cmd);
+        int close_atm(const Command& cmd);
+        int rollback(const Command& cmd);
+        int exchange(const Command& cmd);
+        int invest(const Command& cmd);
+        int sleep(const Command& cmd);
         
         // actual functions
-        int func_open_account(int acc, string pswd, int ils, int usd);
-        int func_deposit(int acc, string pswd, int amount, string curr);
-        int func_withdraw(int acc, string pswd, int amount, string curr);
-        int func_balance(int acc, string pswd);
-        int func_close_account(int acc, string pswd);
-        int func_transfer(int s_acc, string pswd, int t_acc, int amount, string curr);
+        int func_open_account(int acc, const char* pswd, int ils, int usd);
+        int func_deposit(int acc, const char* pswd, int amount, Currency curr);
+        int func_withdraw(int acc, const char* pswd, int amount, Currency curr);
+        int func_balance(int acc, const char* pswd);
+        int func_close_account(int acc, const char* pswd);
+        int func_transfer(int s_acc, const char* pswd, int t_acc, int amount, Currency curr);
         int func_close_atm(int t_atm_id);
         int func_rollback(int it);
-        int func_exchange(int acc, string pswd, string s_curr, string t_curr, int s_amount);
-        int func_invest(int acc, string pswd, int amount, string curr, int time);
-        int sleep_func(int sleep_time_in_ms);
+        int func_exchange(int acc, const char* pswd, Currency s_curr, Currency t_curr, int s_amount);
+        int func_invest(int acc, const char* pswd, int amount, Currency curr, int time);
+        int sleep_func(int sleep_time_in_ms, bool is_vip);
 
         // Helpers
-        enum Currencies {
-            ILS = 0,
-            USD = 1
-        };
         int get_id();
         Bank* get_bank_ptr();
-        bool is_password_correct(int acc_id, string password);
+        bool is_password_correct(int acc_id, const char* password);
     };
     
-void* run_atm(void* arg);
+// An ATM is a task stream on the executor: start_atm() registers it and
+// submits its first step, every step runs the next few commands of the
+// input file and submits the one after it. One step per ATM is queued or
+// running at a time, so its commands keep their order.
+void start_atm(ATM* atm, Executor* executor);
 
 
 #endif
\ No newline at end of file
@@ -0,0 +1,218 @@
+#include "balance_kernels.h"
+#include <immintrin.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Signed division by 100 is a multiply by 0x51EB851F, keeping the high 32
+// bits, an arithmetic shift by 5 and +1 for negative dividends, which is
+// exactly C's truncating division for every int32 value
+#define DIV100_MAGIC 0x51EB851F
+#define DIV100_SHIFT 5
+
+typedef void (*CommissionFunc)(const uint64_t *, int, int, uint64_t *, uint64_t *);
+typedef int (*ChangedFunc)(const uint64_t *, const uint64_t *, int, int *);
+
+/********** scalar **********/
+
+static uint64_t commission_word(uint64_t word, int percentage) {
+  int ils = balance_commission((int)(uint32_t)word, percentage);
+  int usd = balance_commission((int)(uint32_t)(word >> 32), percentage);
+  return (uint64_t)(uint32_t)ils | ((uint64_t)(uint32_t)usd << 32);
+}
+
+// halves are subtracted separately, a borrow must not cross into USD
+static uint64_t sub_halves(uint64_t word, uint64_t amount) {
+  uint32_t ils = (uint32_t)word - (uint32_t)amount;
+  uint32_t usd = (uint32_t)(word >> 32) - (uint32_t)(amount >> 32);
+  return (uint64_t)ils | ((uint64_t)usd << 32);
+}
+
+static void commission_scalar(const uint64_t *words, int n, int percentage,
+                              uint64_t *commission, uint64_t *after) {
+  for (int i = 0; i < n; i++) {
+    commission[i] = commission_word(words[i], percentage);
+    after[i] = sub_halves(words[i], commission[i]);
+  }
+}
+
+static int changed_scalar(const uint64_t *words, const uint64_t *snap, int n,
+                          int *out) {
+  int count = 0;
+  for (int i = 0; i < n; i++) {
+    if (words[i] != snap[i]) {
+      out[count++] = i;
+    }
+  }
+  return count;
+}
+
+/********** SSE4.1 - 2 words (4 balances) per step **********/
+
+__attribute__((target("sse4.1")))
+static __m128i div100_sse4(__m128i x) {
+  const __m128i magic = _mm_set1_epi32(DIV100_MAGIC);
+  __m128i even = _mm_mul_epi32(x, magic);                    // lanes 0, 2
+  __m128i odd = _mm_mul_epi32(_mm_srli_epi64(x, 32), magic); // lanes 1, 3
+  __m128i high = _mm_blend_epi16(_mm_srli_epi64(even, 32), odd, 0xCC);
+  return _mm_add_epi32(_mm_srai_epi32(high, DIV100_SHIFT), _mm_srli_epi32(x, 31));
+}
+
+__attribute__((target("sse4.1")))
+static void commission_sse4(const uint64_t *words, int n, int percentage,
+                            uint64_t *commission, uint64_t *after) {
+  const __m128i p = _mm_set1_epi32(percentage);
+  int i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128i w = _mm_loadu_si128((const __m128i *)(words + i));
+    __m128i c = div100_sse4(_mm_mullo_epi32(w, p));
+    _mm_storeu_si128((__m128i *)(commission + i), c);
+    _mm_storeu_si128((__m128i *)(after + i), _mm_sub_epi32(w, c));
+  }
+  commission_scalar(words + i, n - i, percentage, commission + i, after + i);
+}
+
+__attribute__((target("sse4.1")))
+static int changed_sse4(const uint64_t *words, const uint64_t *snap, int n,
+                        int *out) {
+  int count = 0;
+  int i = 0;
+  for (; i + 2 <= n; i += 2) {
+    __m128i w = _mm_loadu_si128((const __m128i *)(words + i));
+    __m128i s = _mm_loadu_si128((const __m128i *)(snap + i));
+    int same = _mm_movemask_pd(_mm_castsi128_pd(_mm_cmpeq_epi64(w, s)));
+    for (int diff = ~same & 0x3; diff != 0; diff &= diff - 1) {
+      out[count++] = i + __builtin_ctz(diff);
+    }
+  }
+  for (; i < n; i++) {
+    if (words[i] != snap[i]) {
+      out[count++] = i;
+    }
+  }
+  return count;
+}
+
+/********** AVX2 - 4 words (8 balances) per step **********/
+
+__attribute__((target("avx2")))
+static __m256i div100_avx2(__m256i x) {
+  const __m256i magic = _mm256_set1_epi32(DIV100_MAGIC);
+  __m256i even = _mm256_mul_epi32(x, magic);
+  __m256i odd = _mm256_mul_epi32(_mm256_srli_epi64(x, 32), magic);
+  __m256i high = _mm256_blend_epi32(_mm256_srli_epi64(even, 32), odd, 0xAA);
+  return _mm256_add_epi32(_mm256_srai_epi32(high, DIV100_SHIFT),
+                          _mm256_srli_epi32(x, 31));
+}
+
+__attribute__((target("avx2")))
+static void commission_avx2(const uint64_t *words, int n, int percentage,
+                            uint64_t *commission, uint64_t *after) {
+  const __m256i p = _mm256_set1_epi32(percentage);
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i w = _mm256_loadu_si256((const __m256i *)(words + i));
+    __m256i c = div100_avx2(_mm256_mullo_epi32(w, p));
+    _mm256_storeu_si256((__m256i *)(commission + i), c);
+    _mm256_storeu_si256((__m256i *)(after + i), _mm256_sub_epi32(w, c));
+  }
+  commission_scalar(words + i, n - i, percentage, commission + i, after + i);
+}
+
+__attribute__((target("avx2")))
+static int changed_avx2(const uint64_t *words, const uint64_t *snap, int n,
+                        int *out) {
+  int count = 0;
+  int i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i w = _mm256_loadu_si256((const __m256i *)(words + i));
+    __m256i s = _mm256_loadu_si256((const __m256i *)(snap + i));
+    int same = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(w, s)));
+    for (int diff = ~same & 0xF; diff != 0; diff &= diff - 1) {
+      out[count++] = i + __builtin_ctz(diff);
+    }
+  }
+  for (; i < n; i++) {
+    if (words[i] != snap[i]) {
+      out[count++] = i;
+    }
+  }
+  return count;
+}
+
+/********** dispatch **********/
+
+static KernelLevel cpu_level() {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    return KERNELS_AVX2;
+  }
+  if (__builtin_cpu_supports("sse4.1")) {
+    return KERNELS_SSE4;
+  }
+  return KERNELS_SCALAR;
+}
+
+static KernelLevel current_level = KERNELS_SCALAR;
+static CommissionFunc commission_func = commission_scalar;
+static ChangedFunc changed_func = changed_scalar;
+
+KernelLevel set_kernel_level(KernelLevel level) {
+  KernelLevel supported = cpu_level();
+  if (level > supported) {
+    level = supported;
+  }
+  switch (level) {
+  case KERNELS_AVX2:
+    commission_func = commission_avx2;
+    changed_func = changed_avx2;
+    break;
+  case KERNELS_SSE4:
+    commission_func = commission_sse4;
+    changed_func = changed_sse4;
+    break;
+  default:
+    commission_func = commission_scalar;
+    changed_func = changed_scalar;
+    break;
+  }
+  current_level = level;
+  return level;
+}
+
+// picked before main(), so the sweeps never race with the choice
+static KernelLevel init_level() {
+  KernelLevel level = KERNELS_AVX2;
+  const char *env = getenv("BANK_KERNELS");
+  if (env != nullptr) {
+    if (strcmp(env, "scalar") == 0) {
+      level = KERNELS_SCALAR;
+    } else if (strcmp(env, "sse4") == 0) {
+      level = KERNELS_SSE4;
+    }
+  }
+  return set_kernel_level(level);
+}
+
+static KernelLevel initial_level __attribute__((unused)) = init_level();
+
+KernelLevel kernel_level() { return current_level; }
+
+const char *kernel_level_name(KernelLevel level) {
+  switch (level) {
+  case KERNELS_AVX2:
+    return "avx2";
+  case KERNELS_SSE4:
+    return "sse4";
+  default:
+    return "scalar";
+  }
+}
+
+void commission_words(const uint64_t *words, int n, int percentage,
+                      uint64_t *commission, uint64_t *after) {
+  commission_func(words, n, percentage, commission, after);
+}
+
+int changed_words(const uint64_t *words, const uint64_t *snap, int n, int *out) {
+  return changed_func(words, snap, n, out);
+}
@@ -0,0 +1,35 @@
+#ifndef BALANCE_KERNELS_H
+#define BALANCE_KERNELS_H
+
+#include <stdint.h>
+
+using namespace std;
+
+// Data parallel kernels for the bank sweeps over the packed balance words
+// of an AccountTable chunk (two int balances per 64-bit word, see Account).
+// Each kernel has an AVX2, an SSE4.1 and a scalar version, picked once at
+// startup from what the CPU supports. BANK_KERNELS=scalar|sse4|avx2 in the
+// environment caps the choice. All versions give the same results.
+
+enum KernelLevel { KERNELS_SCALAR = 0, KERNELS_SSE4 = 1, KERNELS_AVX2 = 2 };
+
+KernelLevel kernel_level();
+const char *kernel_level_name(KernelLevel level);
+// Caps the level at what the CPU supports, returns the level in use.
+// Not while sweeps are running (tools and benchmarks only).
+KernelLevel set_kernel_level(KernelLevel level);
+
+// Commission on one balance, truncated towards zero like int division
+static inline int balance_commission(int balance, int percentage) {
+  return (int)(unsigned int)((unsigned int)balance * (unsigned int)percentage) / 100;
+}
+
+// For every word, commission[i] holds the commission of percentage % on each
+// of its balances and after[i] the balances with the commission taken
+void commission_words(const uint64_t *words, int n, int percentage,
+                      uint64_t *commission, uint64_t *after);
+
+// Writes the indices where words[i] != snap[i] to out, returns their count
+int changed_words(const uint64_t *words, const uint64_t *snap, int n, int *out);
+
+#endif
@@ -1,76 +1,246 @@
 #include "bank.h"
 #include "atm.h"
 #include "log.h"
+#include <algorithm>
+#include <cmath>
+#include <limits.h>
+#include <string.h>
+#include <time.h>
 
 // TODO: initialize bank state, mutexes, etc.
-Bank::Bank(int num_atms) : bank_ils_blc(0), bank_usd_blc(0) {
-  history.reserve(120);                 // preallocate space for history
-  pthread_mutex_init(&vip_lock, NULL);
-  pthread_cond_init(&vip_cond, NULL);
-  is_bank_running_vip = true;
+Bank::Bank(int num_atms, int history_depth)
+    : bank_ils_blc(0), bank_usd_blc(0), history(history_depth),
+      next_investment(1) {
+  pthread_mutex_init(&view_lock, NULL);
+  pthread_mutex_init(&totals_lock, NULL);
+  pthread_mutex_init(&investments_lock, NULL);
+  bank_lock.instrument_as(INST_LOCK_BANK);
   atm_connected.resize(num_atms, true); // all atms open to business at start
+  for (int shard = 0; shard < ACCOUNT_SHARDS; shard++) {
+    journal_from[shard] = 0;
+  }
 }
 
 Bank::~Bank() {
-  // free accounts
-  for (auto const &pair : accounts) {
-    delete pair.second;
+  timers.drain(); // pay out investments while the accounts still exist
+  if (journal.enabled()) {
+    Log::getInstance().set_before_write(function<void()>());
   }
+
+  // free accounts
   accounts.clear();
   atms.clear(); // clear the map
-  
-  pthread_mutex_destroy(&vip_lock);
-  pthread_cond_destroy(&vip_cond);
+
+  pthread_mutex_destroy(&view_lock);
+  pthread_mutex_destroy(&totals_lock);
+  pthread_mutex_destroy(&investments_lock);
 }
 
 // Account management functions
-bool Bank::add_account(Account *new_account) {
+// Opening and closing accounts only write-lock the owning shard, the bank
+// lock is taken for reading to keep out a concurrent rollback.
+bool Bank::add_account(int account_id, const string &pass, int ils, int usd) {
+  int balance[NUM_CURRENCIES];
+  balance[CURR_ILS] = ils;
+  balance[CURR_USD] = usd;
 
-  bank_lock.writeLock();
+  bank_lock.readLock();
+  accounts.write_lock(account_id);
 
   // If account already exists, return error
-  if (accounts.find(new_account->get_id()) != accounts.end()) {
-    bank_lock.writeUnlock();
-    return false; // account with same id exists
+  bool inserted = accounts.insert(account_id, pass, balance) != nullptr;
+  if (inserted && journal.enabled()) {
+    JournalBatch batch;
+    batch.open_account(account_id, pass, balance);
+    journal.append(batch);
   }
 
-  accounts[new_account->get_id()] = new_account;
-  bank_lock.writeUnlock();
-  return true;
+  accounts.write_unlock(account_id);
+  bank_lock.readUnlock();
+  return inserted; // false if account with same id exists
 }
 
 bool Bank::remove_account(int account_id) {
-  bank_lock.writeLock();
+  bank_lock.readLock();
+  accounts.write_lock(account_id);
+
+  // no other thread is using the account while we hold its shard for writing
+  bool removed = accounts.erase(account_id);
+  if (removed && journal.enabled()) {
+    JournalBatch batch;
+    batch.close_account(account_id);
+    journal.append(batch);
+  }
 
-  auto it = accounts.find(account_id);
-  if (it == accounts.end()) {
-    bank_lock.writeUnlock();
-    return false;
-  } else {
-    Account *acc = it->second;
+  accounts.write_unlock(account_id);
+  bank_lock.readUnlock();
+  return removed;
+}
+
+// Caller must hold the account's shard lock (see lock_account_read)
+Account *Bank::get_account(int account_id) {
+  return accounts.find(account_id);
+}
 
-    // make sure no other thread is using the account
-    acc->lock.writeLock();
-    acc->lock.writeUnlock();
+void Bank::lock_accounts(vector<int> &ids) {
+  sort(ids.begin(), ids.end());
+  ids.erase(unique(ids.begin(), ids.end()), ids.end());
 
-    delete acc; // free account memory
-    accounts.erase(it);
+  bank_lock.readLock();
+  accounts.read_lock_set(ids);
+  for (int id : ids) {
+    Account *account = accounts.find(id);
+    if (account != nullptr) {
+      account->lock.writeLock();
+    }
   }
+}
 
-  bank_lock.writeUnlock();
-  return true;
+void Bank::unlock_accounts(const vector<int> &ids) {
+  // the shards are still held, the same accounts exist
+  for (auto it = ids.rbegin(); it != ids.rend(); ++it) {
+    Account *account = accounts.find(*it);
+    if (account != nullptr) {
+      account->lock.writeUnlock();
+    }
+  }
+  accounts.read_unlock_set(ids);
+  bank_lock.readUnlock();
 }
 
-Account *Bank::get_account(int account_id) {
-  // lock list?
-  auto it = accounts.find(account_id);
-  if (it != accounts.end()) {
-    // unlock list?
-    return it->second;
-  } else {
-    // unlock list?
-    return nullptr;
+// The account locks keep other transactions out, single-account operations
+// still run lock-free: every account gets one balance update that checks
+// the balances it replaces. If one is not covered, the accounts updated
+// before it get their deltas back.
+TransactionStatus Bank::apply_deltas(vector<BalanceDelta> &deltas, JournalOp op,
+                                     int &failed) {
+  for (const BalanceDelta &delta : deltas) {
+    if (get_account(delta.account) == nullptr) {
+      failed = delta.account;
+      return TRANSACTION_NO_ACCOUNT;
+    }
   }
+
+  // grouped by account, in id order and their own order within an account
+  vector<int> order(deltas.size());
+  for (size_t i = 0; i < order.size(); i++) {
+    order[i] = (int)i;
+  }
+  stable_sort(order.begin(), order.end(), [&](int a, int b) {
+    return deltas[a].account < deltas[b].account;
+  });
+
+  typedef struct Group {
+    size_t first, last; // in order
+    int net[NUM_CURRENCIES];
+    bool checked;       // has a debit
+    int balance[NUM_CURRENCIES];
+  } Group;
+  vector<Group> groups;
+  for (size_t i = 0; i < order.size(); i++) {
+    const BalanceDelta &delta = deltas[order[i]];
+    if (groups.empty() || deltas[order[groups.back().first]].account != delta.account) {
+      groups.push_back(Group{i, i, {0}, false, {0}});
+    }
+    Group &group = groups.back();
+    group.last = i + 1;
+    for (int curr = 0; curr < NUM_CURRENCIES; curr++) {
+      group.net[curr] += delta.amount[curr];
+      group.checked = group.checked || delta.amount[curr] < 0;
+    }
+  }
+
+  // The single account commands don't take the account locks, so whatever
+  // is published is spent at once. The debits go first: every debit is
+  // checked against the balance it meets, credits of the same account
+  // included, but only the net debits are taken. An undo then only gives
+  // money back.
+  for (size_t g = 0; g < groups.size(); g++) {
+    Group &group = groups[g];
+    if (!group.checked) {
+      continue;
+    }
+    Account *account = get_account(deltas[order[group.first]].account);
+    bool covered = account->update_balances([&](int *b) {
+      int seen[NUM_CURRENCIES];
+      for (int curr = 0; curr < NUM_CURRENCIES; curr++) {
+        seen[curr] = b[curr];
+      }
+      for (size_t i = group.first; i < group.last; i++) {
+        const int *amount = deltas[order[i]].amount;
+        for (int curr = 0; curr < NUM_CURRENCIES; curr++) {
+          seen[curr] += amount[curr];
+          if (amount[curr] < 0 && seen[curr] < 0) {
+            return false;
+          }
+        }
+      }
+      for (int curr = 0; curr < NUM_CURRENCIES; curr++) {
+        b[curr] += min(group.net[curr], 0);
+      }
+      return true;
+    }, group.balance);
+
+    if (!covered) {
+      for (size_t undo = 0; undo < g; undo++) {
+        Group &taken = groups[undo];
+        if (!taken.checked) {
+          continue;
+        }
+        get_account(deltas[order[taken.first]].account)->update_balances([&](int *b) {
+          for (int curr = 0; curr < NUM_CURRENCIES; curr++) {
+            b[curr] -= min(taken.net[curr], 0);
+          }
+          return true;
+        }, taken.balance);
+      }
+      failed = deltas[order[group.first]].account;
+      return TRANSACTION_NOT_COVERED;
+    }
+  }
+
+  // every debit went through, the credits can't fail
+  for (Group &group : groups) {
+    Account *account = get_account(deltas[order[group.first]].account);
+    if (group.net[CURR_ILS] > 0 || group.net[CURR_USD] > 0) {
+      account->update_balances([&](int *b) {
+        for (int curr = 0; curr < NUM_CURRENCIES; curr++) {
+          b[curr] += max(group.net[curr], 0);
+        }
+        return true;
+      }, group.balance);
+    } else if (!group.checked) {
+      account->get_balances(group.balance); // nothing to add
+    }
+    for (size_t i = group.first; i < group.last; i++) {
+      for (int curr = 0; curr < NUM_CURRENCIES; curr++) {
+        deltas[order[i]].balance[curr] = group.balance[curr];
+      }
+    }
+  }
+
+  if (journal.enabled()) {
+    JournalBatch batch; // all of them or none on replay
+    for (const BalanceDelta &delta : deltas) {
+      batch.delta(op, delta.account, delta.amount);
+    }
+    journal.append(batch);
+  }
+  return TRANSACTION_DONE;
+}
+
+TransactionStatus Bank::transact(vector<BalanceDelta> &deltas, JournalOp op,
+                                 int &failed) {
+  vector<int> ids;
+  ids.reserve(deltas.size());
+  for (const BalanceDelta &delta : deltas) {
+    ids.push_back(delta.account);
+  }
+
+  lock_accounts(ids);
+  TransactionStatus status = apply_deltas(deltas, op, failed);
+  unlock_accounts(ids);
+  return status;
 }
 
 // ATM management functions
@@ -109,181 +279,353 @@ bool Bank::is_atm_connected(int atm_id) {
 }
 
 // Rollback functions
+
+// Records only the accounts that were opened, changed or closed since the
+// previous snapshot. Unchanged accounts cost a compare, not an allocation.
 void Bank::make_snapshot() {
   bank_lock.readLock();
   Status current_status;
 
-  for (auto const &pair : accounts) { // pair refers to <id, Account*>
-    Account *acc = pair.second;
-    
-    acc->lock.readLock(); // lock account for reading
+  for (int shard = 0; shard < ACCOUNT_SHARDS; shard++) {
+    accounts.lock_shard_read(shard);
 
-    AccountData *acc_data = new AccountData(); // allocate memory for copy
+    // closes are seen under the same shard lock as the scan below
+    accounts.take_removed(shard, current_status.removed);
 
-    acc_data->id = acc->get_id();
-    acc_data->password = acc->get_password();
-    acc_data->ils_blc = acc->get_ils_balance();
-    acc_data->usd_blc = acc->get_usd_balance();
+    // scans the shard's balance words, only changed accounts are read
+    accounts.snapshot_shard(shard, [&](const Account &acc, const int *balance) {
+      shared_ptr<AccountData> acc_data = make_shared<AccountData>();
 
-    acc->lock.readUnlock(); // unlock account after reading
+      acc_data->id = acc.get_id();
+      acc_data->password = acc.get_password();
+      for (int curr = 0; curr < NUM_CURRENCIES; curr++) {
+        acc_data->balance[curr] = balance[curr];
+      }
 
-    current_status.accounts_data[acc->get_id()] = acc_data;
-  }
+      current_status.changed.push_back(acc_data);
+    });
 
-  if ((int)history.size() >= 100) {
-    Status& old_status = history.front();
-    for (auto& pair : old_status.accounts_data) {
-        delete pair.second;  // free allocated memory for AccountData
-    }
-    history.erase(history.begin()); // remove oldest entry
+    accounts.unlock_shard_read(shard);
   }
-  history.push_back(current_status);
+
+  pthread_mutex_lock(&view_lock);
+  History::apply(status_view, current_status);
+  pthread_mutex_unlock(&view_lock);
+
+  history.push(std::move(current_status)); // evicts the oldest when full
 
   bank_lock.readUnlock();
 }
 
+// Rolls back in place: only accounts that differ between now and the target
+// iteration are touched, every other Account (and its lock) stays as is.
 void Bank::rollback_bank(int iterations) {
   bank_lock.writeLock();
-  if (iterations > (int)history.size()) {
+  if (iterations >= history.size()) {
     // error - not enough history
     bank_lock.writeUnlock();
     return;
   }
-  // get target status - we can assume itetations is valid (> 0 and <= 100)
-  int target_index = history.size() - iterations - 1;
-  Status target_status = history[target_index]; // save target status
 
-  // Wipe current accounts
-  for (auto const &pair : accounts) {
-    delete pair.second; // for each account, free account memory
+  // accounts changed by the iterations we roll back
+  vector<int> touched;
+  for (int age = 0; age < iterations; age++) {
+    const Status &status = history.at_age(age);
+    for (auto const &record : status.changed) {
+      touched.push_back(record->id);
+    }
+    touched.insert(touched.end(), status.removed.begin(), status.removed.end());
   }
-  accounts.clear(); // clear the map
 
-  // build accounts from snapshot
-  for (auto const &pair : target_status.accounts_data) {
-    AccountData *acc_data = pair.second;
-    Account *new_account = new Account(acc_data->id, acc_data->password,
-                                       acc_data->ils_blc, acc_data->usd_blc);
-    accounts[acc_data->id] = new_account;
+  // and accounts changed since the last snapshot (a compare per account)
+  for (int shard = 0; shard < ACCOUNT_SHARDS; shard++) {
+    accounts.take_removed(shard, touched);
+    accounts.changed_ids(shard, touched);
   }
-  history.resize(target_index + 1); // remove future history
-  
-  bank_lock.writeUnlock();
-}
 
-void Bank::print_status() {
-  bank_lock.readLock();
+  sort(touched.begin(), touched.end());
+  touched.erase(unique(touched.begin(), touched.end()), touched.end());
 
-  printf("\033[2J");   // clear the console
-  printf("\033[1;1H"); // move cursor to top-left corner
+  JournalBatch batch; // the whole rollback replays as one step
 
-  cout << "Current Bank Status" << endl;
+  pthread_mutex_lock(&view_lock);
+  for (int id : touched) {
+    AccountRecord target = history.record_at_age(iterations, id);
+    Account *account = accounts.find(id);
+
+    if (target != nullptr) {
+      batch.set_account(id, target->password, target->balance);
+    } else if (account != nullptr) {
+      batch.close_account(id, JOURNAL_OP_ROLLBACK);
+    }
 
-  // for (auto const &[id, account] : accounts) {
-  for (auto const &pair : accounts) {
-    Account *account = pair.second;
-    account->lock.readLock();
-    cout << "Account " << account->get_id() << ": Balance - "
-         << account->get_ils_balance() << " ILS " << account->get_usd_balance() <<
-        " USD, Account Password - " << account->get_password() << endl;
-    account->lock.readUnlock();
+    if (target != nullptr) {
+      status_view[id] = target;
+    } else {
+      status_view.erase(id);
+    }
+
+    if (target != nullptr && account != nullptr) { // update in place
+      account->restore(target->password, target->balance);
+      accounts.mark_snapshot(id);
+    } else if (target != nullptr) { // closed since - reopen it
+      accounts.insert(id, target->password, target->balance);
+      accounts.mark_snapshot(id);
+    } else if (account != nullptr) { // opened since - close it
+      accounts.erase(id); // the bank write lock keeps everyone else out
+    }
   }
 
-  bank_lock.readUnlock();
-}
+  pthread_mutex_unlock(&view_lock);
 
-void Bank::collect_commission(int percentage) {
-  bank_lock.readLock();
+  journal.append(batch);
 
-  int total_ils_collected = 0;
-  int total_usd_collected = 0;
+  accounts.discard_removed(); // live state is the target iteration now
+  history.drop_newest(iterations); // remove future history
+  
+  bank_lock.writeUnlock();
+}
 
-  for (auto const &pair : accounts) {
-    Account *account = pair.second;
+// Copies the latest snapshot, sorted by account id. Only view_lock is held.
+void Bank::get_status_view(vector<AccountRecord> &view) {
+  pthread_mutex_lock(&view_lock);
+  view.reserve(status_view.size());
+  for (auto const &pair : status_view) {
+    view.push_back(pair.second);
+  }
+  pthread_mutex_unlock(&view_lock);
+}
 
-    account->lock.writeLock();
+// Shards are swept in parallel by the worker pool. Each shard sums its own
+// commissions and log lines, they are reduced into the bank once at the end.
+void Bank::collect_commission(int percentage) {
+  typedef struct ShardCommission {
+    int ils_collected;
+    int usd_collected;
+    string log;
+  } ShardCommission;
 
-    // Get balances
-    int ils_blc = account->get_ils_balance();
-    int usd_blc = account->get_usd_balance();
+  vector<ShardCommission> partial(ACCOUNT_SHARDS);
+  bool journaled = journal.enabled();
 
-    // Calculate commission
-    int ils_commission = (int)((ils_blc * percentage) / 100);
-    int usd_commission = (int)((usd_blc * percentage) / 100);
+  bank_lock.readLock();
 
-    // Take commision from account
-    account->set_ils_balance(-ils_commission);
-    account->set_usd_balance(-usd_commission);
+  sweep_pool.run(ACCOUNT_SHARDS, [&](int shard) {
+    ShardCommission &result = partial[shard];
+    result.ils_collected = 0;
+    result.usd_collected = 0;
+
+    accounts.lock_shard_read(shard);
+    JournalBatch batch;
+
+    // Calculate and take the commission from the same balances, a chunk of
+    // accounts at a time, straight on the shard's balance words
+    accounts.commission_shard(shard, percentage, [&](int id, const int *commission) {
+      int ils_commission = commission[CURR_ILS];
+      int usd_commission = commission[CURR_USD];
+
+      if (journaled && (ils_commission != 0 || usd_commission != 0)) {
+        int delta[NUM_CURRENCIES] = {-ils_commission, -usd_commission};
+        batch.delta(JOURNAL_OP_COMMISSION, id, delta);
+      }
+
+      // Add it to total collected
+      result.ils_collected += ils_commission;
+      result.usd_collected += usd_commission;
+
+      // Log line for the account, written with the rest of the sweep
+      if (!result.log.empty()) {
+        result.log += '\n';
+      }
+      result.log += "Bank: commissions of " + to_string(percentage) +
+                    " % were charged, bank gained " +
+                    to_string(ils_commission) + " ILS and " +
+                    to_string(usd_commission) + " USD from account" +
+                    to_string(id);
+    });
+
+    journal.append(batch); // one frame per shard
+    accounts.unlock_shard_read(shard);
+  });
 
-    // Add it to total collected
-    total_ils_collected += ils_commission;
-    total_usd_collected += usd_commission;
+  bank_lock.readUnlock();
 
-    account->lock.writeUnlock();
-    
-    // Log commission taken from account
-    string msg = "Bank: commissions of " + to_string(percentage) + " % were charged, "
-                 + "bank gained " + to_string(ils_commission) + " ILS and " +
-                to_string(usd_commission) + " USD from account" + 
-                to_string(account->get_id());
-    Log::getInstance().write(msg);
+  int total_ils_collected = 0;
+  int total_usd_collected = 0;
+  string batch;
+
+  for (auto const &result : partial) {
+    total_ils_collected += result.ils_collected;
+    total_usd_collected += result.usd_collected;
+    if (!result.log.empty()) {
+      if (!batch.empty()) {
+        batch += '\n';
+      }
+      batch += result.log;
+    }
   }
 
   // Update bank balance
+  pthread_mutex_lock(&totals_lock);
   bank_ils_blc += total_ils_collected;
   bank_usd_blc += total_usd_collected;
+  pthread_mutex_unlock(&totals_lock);
 
-  bank_lock.readUnlock();
+  if (!batch.empty()) {
+    Log::getInstance().write(batch); // one record for the whole sweep
+  }
 }
 
-// VIP functions
-void Bank::add_vip_command(Command cmd) {
-  pthread_mutex_lock(&vip_lock);
-
-  bool inserted = false;
-  for (auto it = vip_queue.begin(); it != vip_queue.end(); ++it) {
-    if (cmd.vip_priority > it->vip_priority) { // higer priority inserted before
-      vip_queue.insert(it, cmd);
-      inserted = true;
-      break;
-    }
-  }
+// Investments mature by the wall clock, a restart doesn't stop them
+static int64_t wall_clock_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
 
-  // if queue was empty or command has loweset priority
-  if (!inserted) {
-    vip_queue.push_back(cmd);
-  }
+// Investments
+void Bank::schedule_investment(int account_id, Currency curr, int amount,
+                               int time) {
+  JournalInvestment terms;
+  memset(&terms, 0, sizeof(terms));
+  terms.due_ms = wall_clock_ms() + time;
+  terms.amount = amount;
+  terms.time = time;
+  terms.currency = curr;
+  int debit[NUM_CURRENCIES] = {0};
+  debit[curr] = -amount;
+
+  pthread_mutex_lock(&investments_lock);
+  terms.id = next_investment++;
+  investments[terms.id] = {account_id, terms};
+  JournalBatch batch;
+  batch.invest(account_id, debit, terms);
+  journal.append(batch);
+  pthread_mutex_unlock(&investments_lock);
+
+  start_investment(account_id, terms, time);
+}
 
-  pthread_cond_signal(&vip_cond); // signal waiting threads for available command
-  pthread_mutex_unlock(&vip_lock);
+void Bank::start_investment(int account_id, const JournalInvestment &terms,
+                            int delay_ms) {
+  timers.schedule_after(delay_ms, [this, account_id, terms]() {
+    settle_investment(account_id, terms);
+  });
 }
 
-bool Bank::get_next_vip_command(Command &cmd) {
-  pthread_mutex_lock(&vip_lock);
+// Runs on the timer thread once the investment matured. The account is
+// looked up again, if it was closed in the meantime the money is gone.
+void Bank::settle_investment(int account_id, const JournalInvestment &terms) {
+  Currency curr = (Currency)terms.currency;
+  double factor = pow(1.03, (double)terms.time / 10.0); // 3% every 10 ms
+  int final_amount = (int)(terms.amount * factor); // rounded down
+  int payout[NUM_CURRENCIES] = {0};
+
+  lock_account_read(account_id);
+  Account *account = get_account(account_id);
+  if (account != nullptr) {
+    account->add_balance(curr, final_amount);
+    payout[curr] = final_amount;
+  }
+
+  // settled either way, a restart must not pay it again
+  pthread_mutex_lock(&investments_lock);
+  investments.erase(terms.id);
+  JournalBatch batch;
+  batch.settle(account_id, payout, terms);
+  journal.append(batch);
+  pthread_mutex_unlock(&investments_lock);
+  unlock_account_read(account_id);
+  // made durable by the bank thread's next journal flush
+}
 
-  while (vip_queue.empty() && is_bank_running_vip) {
-    pthread_cond_wait(&vip_cond, &vip_lock);
+// Replay runs before any other thread, so no locks are taken
+void Bank::apply_journal(const JournalEntry &entry) {
+  Account *account = accounts.find(entry.account);
+  switch (entry.type) {
+  case JOURNAL_OPEN:
+    accounts.insert(entry.account, entry.password, entry.value);
+    break;
+  case JOURNAL_CLOSE:
+    accounts.erase(entry.account);
+    break;
+  case JOURNAL_SET:
+    if (account != nullptr) {
+      account->restore(entry.password, entry.value);
+    } else {
+      accounts.insert(entry.account, entry.password, entry.value);
+    }
+    break;
+  case JOURNAL_DELTA:
+  case JOURNAL_INVEST:
+  case JOURNAL_SETTLE:
+    if (account != nullptr) {
+      int balance[NUM_CURRENCIES];
+      account->update_balances([&entry](int *b) {
+        for (int curr = 0; curr < NUM_CURRENCIES; curr++) {
+          b[curr] += entry.value[curr];
+        }
+        return true;
+      }, balance);
+    }
+    if (entry.op == JOURNAL_OP_COMMISSION) { // the bank's side of it
+      bank_ils_blc -= entry.value[CURR_ILS];
+      bank_usd_blc -= entry.value[CURR_USD];
+    }
+    break;
   }
-  
-  // if we wake up because bank stopped and queue is empty
-  if (vip_queue.empty()) {
-    pthread_mutex_unlock(&vip_lock);
-    return false;
+}
+
+// Every INVEST and SETTLE counts, whichever side of the checkpoint it is on:
+// the investments left are the ones that were running when the bank stopped
+void Bank::replay_investment(const JournalEntry &entry) {
+  if (entry.type == JOURNAL_INVEST) {
+    investments[entry.investment.id] = {entry.account, entry.investment};
+    next_investment = max(next_investment, entry.investment.id + 1);
+  } else if (entry.type == JOURNAL_SETTLE) {
+    investments.erase(entry.investment.id);
   }
+}
 
-  // get command from queue
-  cmd = vip_queue.front();
-  vip_queue.erase(vip_queue.begin());
+bool Bank::open_journal(const string &path) {
+  // records a loaded checkpoint already holds are skipped
+  uint64_t from = journal_from[0];
+  for (int shard = 1; shard < ACCOUNT_SHARDS; shard++) {
+    from = min(from, journal_from[shard]);
+  }
+  bool opened = journal.open(path, from, [this](const JournalEntry &entry,
+                                                uint64_t offset) {
+    replay_investment(entry);
+    if (offset >= journal_from[AccountTable::shard_of(entry.account)]) {
+      apply_journal(entry);
+    }
+  });
+  accounts.discard_removed(); // the first snapshot starts from here
+
+  // a command's log line only reaches log.txt once its records are durable,
+  // one sync covers every command in a log batch
+  if (opened) {
+    Log::getInstance().set_before_write([this]() { journal.flush(); });
+
+    // the ones that matured while the bank was down are paid right away
+    int64_t now = wall_clock_ms();
+    for (const auto &it : investments) {
+      int64_t left = it.second.terms.due_ms - now;
+      start_investment(it.second.account, it.second.terms,
+                       (int)max<int64_t>(0, min<int64_t>(left, INT_MAX)));
+    }
+  }
+  return opened;
+}
 
-  pthread_mutex_unlock(&vip_lock);
-  return true;
+// VIP functions
+void Bank::add_vip_command(Command cmd) {
+  vip_queue.push(cmd);
 }
 
-void Bank::stop_vip_thread() {
-  pthread_mutex_lock(&vip_lock);
-  is_bank_running_vip = false;
-  pthread_cond_broadcast(&vip_cond);
-  pthread_mutex_unlock(&vip_lock);
+// The most urgent waiting command, false if there is none
+bool Bank::take_vip_command(Command &cmd) {
+  return vip_queue.try_pop(cmd);
 }
 
 ATM* Bank::get_atm(int atm_id) {
@@ -302,4 +644,64 @@ bool Bank::atm_exists(int atm_id) {
   bool exists = (atms.find(atm_id - 1) != atms.end());
   bank_lock.readUnlock();
   return exists;
+}
+// Each shard is copied under its write lock, so none of its accounts is
+// half way through a change, and tagged with the journal offset of that
+// moment. Runs on the bank thread, so no commission sweep is half done and
+// the bank's balances match the commission records before the offsets.
+bool Bank::write_checkpoint(const string &path) {
+  CheckpointWriter checkpoint;
+
+  bank_lock.readLock(); // keeps rollback out, ATMs go on
+  for (int shard = 0; shard < ACCOUNT_SHARDS; shard++) {
+    accounts.lock_shard_write(shard);
+    accounts.for_each_in_shard(shard, [&](const Account &acc, uint64_t balances) {
+      checkpoint.add(acc.get_id(), balances, acc.get_password());
+    });
+    checkpoint.set_journal_offset(shard, journal.end_offset());
+    accounts.unlock_shard_write(shard);
+  }
+
+  pthread_mutex_lock(&totals_lock);
+  int bank_balance[NUM_CURRENCIES] = {bank_ils_blc, bank_usd_blc};
+  pthread_mutex_unlock(&totals_lock);
+  bank_lock.readUnlock();
+
+  checkpoint.set_bank_balance(bank_balance);
+
+  // running investments are journaled again past every offset, replay
+  // starts after the INVEST records of the older ones
+  pthread_mutex_lock(&investments_lock);
+  JournalBatch carried;
+  for (const auto &it : investments) {
+    carried.invest(it.second.account, nullptr, it.second.terms);
+  }
+  journal.append(carried);
+  pthread_mutex_unlock(&investments_lock);
+
+  // every record up to the offsets is on disk before the checkpoint points
+  // at them - the file must never be ahead of the journal
+  journal.flush();
+  return checkpoint.write(path); // the file is written with no lock held
+}
+
+// Runs before any other thread, so no locks are taken
+bool Bank::load_checkpoint(const string &path) {
+  CheckpointFile checkpoint;
+  if (!checkpoint.open(path)) {
+    return false;
+  }
+
+  accounts.reserve(checkpoint.accounts());
+  checkpoint.for_each([this](int id, const int *balance, const char *password,
+                             size_t password_len) {
+    accounts.insert(id, string(password, password_len), balance);
+  });
+
+  bank_ils_blc = checkpoint.bank_balance()[CURR_ILS];
+  bank_usd_blc = checkpoint.bank_balance()[CURR_USD];
+  for (int shard = 0; shard < ACCOUNT_SHARDS; shard++) {
+    journal_from[shard] = checkpoint.journal_offset(shard);
+  }
+  return true;
 }
\ No newline at end of file
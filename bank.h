@@ -2,8 +2,15 @@
 #define BANK_H
 
 #include "account.h"
+#include "account_table.h"
+#include "checkpoint.h"
 #include "command.h"
+#include "history.h"
+#include "journal.h"
 #include "reader_writer.h"
+#include "timer_queue.h"
+#include "vip_queue.h"
+#include "worker_pool.h"
 #include <fstream>
 #include <iostream>
 #include <map>
@@ -17,49 +24,113 @@ using namespace std;
 
 class ATM; // forward declaration
 
-typedef struct AccountData {
-  int id;
-  string password;
-  int ils_blc;
-  int usd_blc;
-} AccountData;
-
-typedef struct Status {
-  map<int, AccountData *> accounts_data;
-} Status;
+// One account's part of a multi-account transaction
+typedef struct BalanceDelta {
+  int account;
+  int amount[NUM_CURRENCIES];  // added to the balances, negative - a debit
+  int balance[NUM_CURRENCIES]; // the account's balances after it went through
+} BalanceDelta;
+
+enum TransactionStatus {
+  TRANSACTION_DONE,
+  TRANSACTION_NO_ACCOUNT,  // an account doesn't exist
+  TRANSACTION_NOT_COVERED  // a debit is more than the balance it meets
+};
 
 class Bank {
 private:
-  map<int, Account *> accounts;
+  AccountTable accounts; // sharded by account id
   map<int, ATM *> atms; // track active ATMs in bank
 
   int bank_ils_blc;
   int bank_usd_blc;
+  pthread_mutex_t totals_lock; // bank balances
+
+  WorkerPool sweep_pool; // commission sweeps over the shards
 
-  vector<Status> history; // history for rollback
+  History history; // last iterations for rollback
+
+  // State as of the latest snapshot, for readers that must not take the
+  // bank locks (status printing)
+  map<int, AccountRecord> status_view;
+  pthread_mutex_t view_lock;
 
   ReadWriteLock bank_lock;
 
   // VIP management
-  vector<Command> vip_queue;
-  pthread_mutex_t vip_lock;
-  pthread_cond_t vip_cond;
-  bool is_bank_running_vip; 
+  VipQueue vip_queue;
 
   vector<bool> atm_connected;
 
+  Journal journal; // disabled unless open_journal() was called
+  uint64_t journal_from[ACCOUNT_SHARDS]; // per shard, set by load_checkpoint()
+
+  // Investments not paid out yet by id, a checkpoint journals them again
+  typedef struct PendingInvestment {
+    int account;
+    JournalInvestment terms;
+  } PendingInvestment;
+  map<uint64_t, PendingInvestment> investments;
+  uint64_t next_investment;
+  pthread_mutex_t investments_lock; // investments, next_investment, their records
+
+  TimerQueue timers; // matured investments, declared last - destroyed first
+
+  void apply_journal(const JournalEntry &entry);
+  void replay_investment(const JournalEntry &entry);
+  void start_investment(int account_id, const JournalInvestment &terms, int delay_ms);
+
 public:
-  Bank(int num_atms);
+  Bank(int num_atms, int history_depth = HISTORY_DEPTH);
   ~Bank();
 
-  // Bank locking helpers
-  void lock_bank_read() { bank_lock.readLock(); }
-  void unlock_bank_read() { bank_lock.readUnlock(); }
+  // Account locking helpers - keep the account alive while it is used.
+  // bank_lock is only held for writing by rollback, so ATMs touching
+  // different shards never block each other.
+  void lock_account_read(int account_id) {
+    bank_lock.readLock();
+    accounts.read_lock(account_id);
+  }
+  void unlock_account_read(int account_id) {
+    accounts.read_unlock(account_id);
+    bank_lock.readUnlock();
+  }
+
+  // Any set of accounts, for transactions over several of them. Sorts the
+  // ids and drops repeats, then takes bank_lock, their shards in shard
+  // order and the locks of the accounts that exist in id order - so
+  // transactions over overlapping sets never deadlock and a transfer to
+  // the same account takes its lock once.
+  void lock_accounts(vector<int> &ids);
+  void unlock_accounts(const vector<int> &ids);
+
+  // With the accounts locked: applies every delta or none, and journals
+  // them as one frame. The deltas of an account apply in their order, each
+  // debit checked against the balance it meets. Credits are only published
+  // once every debit went through, so no one spends money a failed
+  // transaction takes back. On failure nothing changed and failed is the
+  // account that was missing or not covered.
+  TransactionStatus apply_deltas(vector<BalanceDelta> &deltas, JournalOp op,
+                                 int &failed);
+  // lock_accounts(), apply_deltas(), unlock_accounts() in one step
+  TransactionStatus transact(vector<BalanceDelta> &deltas, JournalOp op,
+                             int &failed);
 
   void collect_commission(int percentage);
 
+  // Write-ahead journal - replays path into the bank and records every
+  // change from then on. Before any thread touches the bank, after
+  // load_checkpoint() if there is one.
+  bool open_journal(const string &path);
+
+  // Checkpoints - written by the bank thread between sweeps, without
+  // stopping the ATMs; loaded into an empty bank at startup
+  bool write_checkpoint(const string &path);
+  bool load_checkpoint(const string &path);
+  Journal &get_journal() { return journal; }
+
   // Account management
-  bool add_account(Account *new_account);
+  bool add_account(int account_id, const string &pass, int ils, int usd);
   bool remove_account(int account_id);
   Account *get_account(int account_id);
 
@@ -73,14 +144,18 @@ public:
   // Rollback functions
   void make_snapshot();
   void rollback_bank(int iterations);
-  void print_status();
+  void get_status_view(vector<AccountRecord> &view);
+
+  // Investments - with the account locked, right after the caller took the
+  // amount from it: journals the debit with the terms, then the timer
+  // thread pays it back
+  void schedule_investment(int account_id, Currency curr, int amount, int time);
+  void settle_investment(int account_id, const JournalInvestment &terms);
+  void drain_timers() { timers.drain(); }
 
-  // VIP functions
+  // VIP functions - an urgent executor task takes each command added
   void add_vip_command(Command cmd);
-  bool get_next_vip_command(Command &cmd);
-  void stop_vip_thread();
-  pthread_cond_t* get_vip_cond() { return &vip_cond;}
-  pthread_mutex_t* get_vip_lock() { return &vip_lock; }
+  bool take_vip_command(Command &cmd);
 };
 
 void *bank_func(
@@ -1,9 +1,17 @@
 #include "atm.h"
 #include "bank.h"
+#include "instrument.h"
 #include "log.h"
+#include "status_renderer.h"
+#include <atomic>
+#include <errno.h>
 #include <fstream>
 #include <iostream>
 #include <pthread.h>
+#ifdef BANK_TEST_HOOKS
+#include <signal.h>
+#endif
+#include <string.h>
 #include <string>
 #include <unistd.h>
 #include <vector>
@@ -11,54 +19,114 @@
 #define SUCCESS 0
 #define ERROR 1
 
+// set by the Makefile, see "make release" and friends
+#ifndef BANK_BUILD_VARIANT
+#define BANK_BUILD_VARIANT "unknown"
+#endif
+#ifndef BANK_BUILD_FLAGS
+#define BANK_BUILD_FLAGS ""
+#endif
+#ifndef BANK_BUILD_REV
+#define BANK_BUILD_REV ""
+#endif
+
 using namespace std;
 
 Bank *bank_ptr = nullptr;
-bool is_bank_running = true;
+atomic<bool> is_bank_running(true); // read by the bank thread
+const char *checkpoint_path = nullptr; // BANK_CHECKPOINT
+#ifdef BANK_TEST_HOOKS
+bool kill_after_checkpoint = false; // BANK_TEST_KILL_AFTER_CHECKPOINT, crash tests
+#endif
 
 // Provide definitions so the linker can find them.
 // (Temporary no-op implementations for single-ATM bring-up.)
 void *bank_func(void *arg) {
   Bank *bank = (Bank *)arg;
   int counter = 0;
+  INST_THREAD_NAME("bank", -1);
 
   while (is_bank_running) {
     counter++;
     
-    bank->make_snapshot();
-    bank->print_status();
+    {
+      INST_SWEEP(INST_SWEEP_SNAPSHOT);
+      bank->make_snapshot();
+    }
     
     // Take commissions every 3 iterations since 3*10ms = 30ms
     if (counter % 3 == 0) {
+      INST_SWEEP(INST_SWEEP_COMMISSION);
       int percentage = (rand() % 5) + 1; // random percentage between 1 and 5
       bank->collect_commission(percentage);
     }
 
+    INST_POLL(); // dump requested with SIGUSR1
+
+    // investment settlements are not logged, nothing else flushes them
+    bank->get_journal().flush();
+
+    if (checkpoint_path != nullptr && counter % CHECKPOINT_ITERATIONS == 0) {
+      if (!bank->write_checkpoint(checkpoint_path)) {
+        cerr << "Bank error: can't write checkpoint " << checkpoint_path << ": "
+             << strerror(errno) << endl;
+      }
+#ifdef BANK_TEST_HOOKS
+      else if (kill_after_checkpoint) {
+        raise(SIGKILL); // right after the rename, ATMs still appending
+      }
+#endif
+    }
+
     usleep(10000); // Sleep for 10ms
   }
 
-  // bank->print_status(); 
-
   return nullptr;
 }
 
-void *vip_thread_func(void *arg) {
-  Bank *bank = (Bank *)arg;
-  Command cmd;
-  
-  // VIP thread loop
-  while (bank->get_next_vip_command(cmd)) {
-      ATM* atm = bank->get_atm(cmd.atm_id);
-      if (atm) {
-          atm->run_command(cmd);
-      }
+// "bank <variant> rev <git rev> g++ <version> [<variant flags>] ..."
+static string build_info() {
+  string info = string("bank ") + BANK_BUILD_VARIANT;
+  if (BANK_BUILD_REV[0] != '\0') {
+    info += string(" rev ") + BANK_BUILD_REV;
   }
-  return nullptr;
+  info += string(" g++ ") + __VERSION__;
+  info += string(" [") + BANK_BUILD_FLAGS + "]";
+#ifdef __OPTIMIZE__
+  info += " optimized";
+#endif
+#ifdef NDEBUG
+  info += " asserts=off";
+#else
+  info += " asserts=on";
+#endif
+#ifdef BANK_INSTRUMENT
+  info += " instrument=on";
+#else
+  info += " instrument=off";
+#endif
+#ifdef __SANITIZE_THREAD__
+  info += " tsan";
+#endif
+#ifdef __SANITIZE_ADDRESS__
+  info += " asan";
+#endif
+#ifdef BANK_TEST_HOOKS
+  info += " test-hooks";
+#endif
+  return info;
 }
 
 int main(int argc, char *argv[]) {
+  if (argc == 2 && string(argv[1]) == "--build-info") {
+    cout << build_info() << endl;
+    return SUCCESS;
+  }
+
   // Initialize log to preven thread race condition
   Log::getInstance();
+  INST_INIT();
+  INST_THREAD_NAME("main", -1);
 
   srand(time(NULL)); // seed random generator 
 
@@ -87,49 +155,71 @@ int main(int argc, char *argv[]) {
   }
 
   bank_ptr = new Bank(num_atms);
+
+  // BANK_CHECKPOINT=<file> - start from it if it exists, rewrite it while
+  // running and at exit
+  checkpoint_path = getenv("BANK_CHECKPOINT");
+  if (checkpoint_path != nullptr && checkpoint_path[0] == '\0') {
+    checkpoint_path = nullptr;
+  }
+#ifdef BANK_TEST_HOOKS
+  kill_after_checkpoint = getenv("BANK_TEST_KILL_AFTER_CHECKPOINT") != nullptr;
+#endif
+  if (checkpoint_path != nullptr && !bank_ptr->load_checkpoint(checkpoint_path) &&
+      errno != ENOENT) {
+    cerr << "Bank error: can't load checkpoint " << checkpoint_path << ": "
+         << strerror(errno) << endl;
+    delete bank_ptr;
+    return ERROR;
+  }
+
+  // BANK_JOURNAL=<file> - restore the accounts from it and keep it going
+  const char *journal_path = getenv("BANK_JOURNAL");
+  if (journal_path != nullptr && journal_path[0] != '\0' &&
+      !bank_ptr->open_journal(journal_path)) {
+    cerr << "Bank error: can't open journal " << journal_path << ": "
+         << strerror(errno) << endl;
+    delete bank_ptr;
+    return ERROR;
+  }
+  StatusRenderer status_renderer(bank_ptr); // prints from snapshots
+  status_renderer.start();
+
   pthread_t bank_t;
   if (pthread_create(&bank_t, NULL, bank_func, (void *)bank_ptr) != 0) {
     cerr << "Bank error: pthread_create failed" << endl;
     delete bank_ptr;
     return ERROR;
   }
+  // ATMs and VIP commands share the executor's workers, VIP commands go
+  // first on at most vip_thread_num of them at a time
+  Executor executor(0, vip_thread_num);
   vector<ATM *> atms;
-  vector<pthread_t> atm_threads(num_atms);
   for (int i = 0; i < num_atms; ++i) {
     atms.push_back(new ATM(i + 1, atm_input_files[i], bank_ptr, num_atms));
-
-    if (pthread_create(&atm_threads[i], NULL, run_atm, (void *)atms[i]) != 0) {
-      cerr << "Bank error: pthread_create failed" << endl;
-      return ERROR;
-    }
+    start_atm(atms[i], &executor);
   }
 
-  // vip threads
-  vector<pthread_t> vip_thread(vip_thread_num);
-  for (int i = 0; i < vip_thread_num; ++i) {
-    if (pthread_create(&vip_thread[i], NULL, vip_thread_func, (void *)bank_ptr) != 0) {
-      cerr << "Bank error: pthread_create failed" << endl;
-      return ERROR;
-    }
-  }
+  // every ATM is done and so is every VIP command they queued
+  executor.wait_idle();
 
-  for (int i = 0; i < num_atms; ++i) {
-    pthread_join(atm_threads[i], NULL);
-  }
-
-  // Signal VIP threads to stop
-  bank_ptr->stop_vip_thread();
-  for (int i = 0; i < vip_thread_num; ++i) {
-    pthread_join(vip_thread[i], NULL);
-  }
+  // Wait for the investments that are still running
+  bank_ptr->drain_timers();
 
   is_bank_running = false;
   pthread_join(bank_t, NULL);
+  status_renderer.stop();
+
+  if (checkpoint_path != nullptr && !bank_ptr->write_checkpoint(checkpoint_path)) {
+    cerr << "Bank error: can't write checkpoint " << checkpoint_path << ": "
+         << strerror(errno) << endl;
+  }
 
   for (ATM *atm : atms) {
     delete atm;
   }
   delete bank_ptr;
 
+  INST_DUMP();
   return SUCCESS;
 }
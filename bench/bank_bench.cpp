@@ -0,0 +1,596 @@
+// Micro-benchmarks for the bank hot paths and its synchronization primitives.
+// Every case reports throughput and p50/p99/p999 latency as one JSON object,
+// the whole run is printed as a JSON array (stdout or --out FILE), so runs
+// of two releases can be diffed by a script.
+//
+//   ./bank_bench [--quick] [--ops N] [--out FILE]
+
+#include "atm.h"
+#include "balance_kernels.h"
+#include "bank.h"
+#include "executor.h"
+#include "log.h"
+#include "reader_writer.h"
+#include "vip_queue.h"
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iostream>
+#include <pthread.h>
+#include <random>
+#include <sstream>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+#define BENCH_PASSWORD "1234"
+#define BENCH_BALANCE 100000000 // withdrawals never run dry
+#define HOT_ACCOUNTS 8          // accounts hit by the contended share of ops
+
+static long long now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Results of benchmarked code nothing else reads, stored so the compiler
+// can't drop the code
+static volatile long bench_sink;
+
+typedef struct Result {
+  string name;
+  string params; // extra JSON members, "" or starting with ','
+  long ops;
+  double seconds;
+  vector<long long> latencies_ns;
+} Result;
+
+static vector<string> results;
+
+static long long percentile(const vector<long long> &sorted, double p) {
+  if (sorted.empty()) {
+    return 0;
+  }
+  size_t index = (size_t)(p * (sorted.size() - 1));
+  return sorted[index];
+}
+
+static void report(Result &result) {
+  sort(result.latencies_ns.begin(), result.latencies_ns.end());
+
+  ostringstream json;
+  json << "{\"bench\":\"" << result.name << "\"" << result.params
+       << ",\"ops\":" << result.ops << ",\"seconds\":" << result.seconds
+       << ",\"ops_per_sec\":"
+       << (result.seconds > 0 ? (long long)(result.ops / result.seconds) : 0)
+       << ",\"p50_ns\":" << percentile(result.latencies_ns, 0.50)
+       << ",\"p99_ns\":" << percentile(result.latencies_ns, 0.99)
+       << ",\"p999_ns\":" << percentile(result.latencies_ns, 0.999) << "}";
+  results.push_back(json.str());
+  cerr << json.str() << endl; // progress
+}
+
+static string params(int threads, int accounts, double contention) {
+  ostringstream out;
+  out << ",\"threads\":" << threads << ",\"accounts\":" << accounts
+      << ",\"contention\":" << contention;
+  return out.str();
+}
+
+static Bank *make_bank(int num_accounts, int balance) {
+  Bank *bank = new Bank(1);
+  for (int id = 0; id < num_accounts; id++) {
+    bank->add_account(id, BENCH_PASSWORD, balance, balance);
+  }
+  return bank;
+}
+
+// ----- Bank operations under N threads -----
+
+enum BankOp { OP_DEPOSIT, OP_WITHDRAW, OP_TRANSFER, OP_EXCHANGE };
+static const char *op_names[] = {"func_deposit", "func_withdraw",
+                                 "func_transfer", "func_exchange"};
+
+typedef struct OpThreadArgs {
+  ATM *atm;
+  BankOp op;
+  int num_accounts;
+  double contention;
+  long ops;
+  unsigned seed;
+  vector<long long> latencies_ns;
+} OpThreadArgs;
+
+static void *op_thread(void *arg) {
+  OpThreadArgs *args = (OpThreadArgs *)arg;
+  mt19937 rng(args->seed);
+  uniform_real_distribution<double> coin(0.0, 1.0);
+  uniform_int_distribution<int> any(0, args->num_accounts - 1);
+  uniform_int_distribution<int> hot(0, min(HOT_ACCOUNTS, args->num_accounts) - 1);
+
+  args->latencies_ns.reserve(args->ops);
+  for (long i = 0; i < args->ops; i++) {
+    int acc = (coin(rng) < args->contention) ? hot(rng) : any(rng);
+    int other = (coin(rng) < args->contention) ? hot(rng) : any(rng);
+    if (other == acc) {
+      other = (acc + 1) % args->num_accounts;
+    }
+
+    long long start = now_ns();
+    switch (args->op) {
+    case OP_DEPOSIT:
+      args->atm->func_deposit(acc, BENCH_PASSWORD, 1, CURR_ILS);
+      break;
+    case OP_WITHDRAW:
+      args->atm->func_withdraw(acc, BENCH_PASSWORD, 1, CURR_ILS);
+      break;
+    case OP_TRANSFER:
+      args->atm->func_transfer(acc, BENCH_PASSWORD, other, 1, CURR_USD);
+      break;
+    case OP_EXCHANGE:
+      args->atm->func_exchange(acc, BENCH_PASSWORD, CURR_ILS, CURR_USD, 5);
+      break;
+    }
+    args->latencies_ns.push_back(now_ns() - start);
+  }
+  return nullptr;
+}
+
+static void bench_bank_op(BankOp op, int threads, int num_accounts,
+                          double contention, long ops_per_thread) {
+  Bank *bank = make_bank(num_accounts, BENCH_BALANCE);
+  string no_file;
+  vector<ATM *> atms;
+  vector<OpThreadArgs> args(threads);
+  vector<pthread_t> tids(threads);
+
+  for (int i = 0; i < threads; i++) {
+    atms.push_back(new ATM(i + 1, no_file, bank, threads));
+    args[i].atm = atms[i];
+    args[i].op = op;
+    args[i].num_accounts = num_accounts;
+    args[i].contention = contention;
+    args[i].ops = ops_per_thread;
+    args[i].seed = 1000 + i;
+  }
+
+  long long start = now_ns();
+  for (int i = 0; i < threads; i++) {
+    pthread_create(&tids[i], NULL, op_thread, &args[i]);
+  }
+  for (int i = 0; i < threads; i++) {
+    pthread_join(tids[i], NULL);
+  }
+
+  Result result;
+  result.name = op_names[op];
+  result.params = params(threads, num_accounts, contention);
+  result.seconds = (now_ns() - start) / 1e9;
+  result.ops = ops_per_thread * threads;
+  for (int i = 0; i < threads; i++) {
+    result.latencies_ns.insert(result.latencies_ns.end(),
+                               args[i].latencies_ns.begin(),
+                               args[i].latencies_ns.end());
+  }
+  report(result);
+
+  for (ATM *atm : atms) {
+    delete atm;
+  }
+  delete bank;
+}
+
+// ----- Bank thread sweeps -----
+
+// Touch `changed` accounts so the next snapshot has work to do
+static void mutate(ATM *atm, int num_accounts, int changed, mt19937 &rng) {
+  uniform_int_distribution<int> any(0, num_accounts - 1);
+  for (int i = 0; i < changed; i++) {
+    atm->func_deposit(any(rng), BENCH_PASSWORD, 1, CURR_USD);
+  }
+}
+
+static void bench_sweeps(int num_accounts, int changed, int rounds,
+                         KernelLevel level) {
+  Bank *bank = make_bank(num_accounts, 1000000);
+  string no_file;
+  ATM atm(1, no_file, bank, 1);
+  mt19937 rng(7);
+  string extra = params(1, num_accounts, 0) + ",\"changed\":" + to_string(changed) +
+                 ",\"kernels\":\"" + kernel_level_name(level) + "\"";
+
+  bank->make_snapshot(); // first one records every account
+
+  Result snapshot = {"make_snapshot", extra, rounds, 0, {}};
+  Result rollback = {"rollback_bank", extra, rounds, 0, {}};
+  Result commission = {"collect_commission", extra, rounds, 0, {}};
+
+  for (int i = 0; i < rounds; i++) {
+    mutate(&atm, num_accounts, changed, rng);
+    long long start = now_ns();
+    bank->make_snapshot();
+    long long took = now_ns() - start;
+    snapshot.latencies_ns.push_back(took);
+    snapshot.seconds += took / 1e9;
+
+    mutate(&atm, num_accounts, changed, rng);
+    bank->make_snapshot();
+    mutate(&atm, num_accounts, changed, rng);
+    start = now_ns();
+    bank->rollback_bank(1);
+    took = now_ns() - start;
+    rollback.latencies_ns.push_back(took);
+    rollback.seconds += took / 1e9;
+
+    start = now_ns();
+    bank->collect_commission(1);
+    took = now_ns() - start;
+    commission.latencies_ns.push_back(took);
+    commission.seconds += took / 1e9;
+  }
+
+  report(snapshot);
+  report(rollback);
+  report(commission);
+  delete bank;
+}
+
+// The sweep kernels alone, over one slab chunk worth of words at a time
+static void bench_kernels(KernelLevel level, long rounds) {
+  const int n = 128;
+  vector<uint64_t> words(n), snap(n), commission(n), after(n);
+  vector<int> changed(n);
+  mt19937_64 rng(11);
+  for (int i = 0; i < n; i++) {
+    words[i] = rng() & 0x00ffffff00ffffffULL;
+    snap[i] = (i % 16 == 0) ? 0 : words[i];
+  }
+
+  string extra = string(",\"words\":") + to_string(n) + ",\"kernels\":\"" +
+                 kernel_level_name(level) + "\"";
+  Result commission_result = {"commission_words", extra, rounds, 0, {}};
+  Result changed_result = {"changed_words", extra, rounds, 0, {}};
+  long sink = 0;
+
+  for (long i = 0; i < rounds; i++) {
+    long long start = now_ns();
+    commission_words(words.data(), n, 1 + i % 5, commission.data(), after.data());
+    long long took = now_ns() - start;
+    commission_result.latencies_ns.push_back(took);
+    commission_result.seconds += took / 1e9;
+    sink += (long)after[i % n];
+
+    start = now_ns();
+    sink += changed_words(words.data(), snap.data(), n, changed.data());
+    took = now_ns() - start;
+    changed_result.latencies_ns.push_back(took);
+    changed_result.seconds += took / 1e9;
+  }
+
+  report(commission_result);
+  report(changed_result);
+  bench_sink = sink;
+}
+
+// ----- Checkpoints -----
+
+#define BENCH_CHECKPOINT "bank_bench.ckpt"
+
+// Restart paths for num_accounts accounts: writing and loading a checkpoint
+// against opening every account again through the ATM
+static void bench_checkpoint(int num_accounts, int rounds) {
+  string extra = params(1, num_accounts, 0);
+  Result opens = {"open_accounts", extra, rounds, 0, {}};
+  Result write = {"checkpoint_write", extra, rounds, 0, {}};
+  Result load = {"checkpoint_load", extra, rounds, 0, {}};
+  string no_file;
+
+  for (int i = 0; i < rounds; i++) {
+    Bank *bank = new Bank(1);
+    ATM atm(1, no_file, bank, 1);
+    long long start = now_ns();
+    for (int id = 0; id < num_accounts; id++) {
+      atm.func_open_account(id, BENCH_PASSWORD, 1000, 1000);
+    }
+    long long took = now_ns() - start;
+    opens.latencies_ns.push_back(took);
+    opens.seconds += took / 1e9;
+
+    start = now_ns();
+    bank->write_checkpoint(BENCH_CHECKPOINT);
+    took = now_ns() - start;
+    write.latencies_ns.push_back(took);
+    write.seconds += took / 1e9;
+    delete bank;
+
+    Bank *restored = new Bank(1);
+    start = now_ns();
+    restored->load_checkpoint(BENCH_CHECKPOINT);
+    took = now_ns() - start;
+    load.latencies_ns.push_back(took);
+    load.seconds += took / 1e9;
+    delete restored;
+  }
+  unlink(BENCH_CHECKPOINT);
+
+  report(opens);
+  report(write);
+  report(load);
+}
+
+// ----- Multi-account transactions -----
+
+// Account 0 pays 1 ILS to every other account: as one transfer each, and
+// as one transaction with all of them
+static void bench_payroll(int payees, int rounds) {
+  Bank *bank = make_bank(payees + 1, BENCH_BALANCE);
+  string no_file;
+  ATM atm(1, no_file, bank, 1);
+  string extra = params(1, payees + 1, 0);
+  Result transfers = {"payroll_transfers", extra, rounds, 0, {}};
+  Result transaction = {"payroll_transaction", extra, rounds, 0, {}};
+
+  for (int i = 0; i < rounds; i++) {
+    long long start = now_ns();
+    for (int id = 1; id <= payees; id++) {
+      atm.func_transfer(0, BENCH_PASSWORD, id, 1, CURR_ILS);
+    }
+    long long took = now_ns() - start;
+    transfers.latencies_ns.push_back(took);
+    transfers.seconds += took / 1e9;
+
+    start = now_ns();
+    vector<BalanceDelta> deltas(payees + 1);
+    for (int id = 0; id <= payees; id++) {
+      deltas[id].account = id;
+      deltas[id].amount[CURR_ILS] = id == 0 ? -payees : 1;
+      deltas[id].amount[CURR_USD] = 0;
+    }
+    int failed;
+    bank->transact(deltas, JOURNAL_OP_TRANSFER, failed);
+    took = now_ns() - start;
+    transaction.latencies_ns.push_back(took);
+    transaction.seconds += took / 1e9;
+  }
+  delete bank;
+
+  report(transfers);
+  report(transaction);
+}
+
+// ----- VIP queue -----
+// Same path as the bank: every push submits an urgent executor task that
+// takes the highest waiting command.
+
+typedef struct VipArgs {
+  VipQueue *queue;
+  Executor *executor;
+  long ops;
+  unsigned seed;
+  vector<long long> latencies_ns;
+  // pop timings from the urgent tasks, slots handed out by next_pop
+  long long *pop_ns;
+  atomic<long> *next_pop;
+} VipArgs;
+
+static void *vip_producer(void *arg) {
+  VipArgs *args = (VipArgs *)arg;
+  mt19937 rng(args->seed);
+  uniform_int_distribution<int> priority(VIP_MIN_PRIORITY, VIP_MAX_PRIORITY);
+  Command cmd;
+  memset(&cmd, 0, sizeof(cmd));
+  VipQueue *queue = args->queue;
+  long long *pop_ns = args->pop_ns;
+  atomic<long> *next_pop = args->next_pop;
+
+  args->latencies_ns.reserve(args->ops);
+  for (long i = 0; i < args->ops; i++) {
+    cmd.vip_priority = priority(rng);
+    long long start = now_ns();
+    queue->push(cmd);
+    args->latencies_ns.push_back(now_ns() - start);
+
+    args->executor->submit_urgent([queue, pop_ns, next_pop]() {
+      Command taken;
+      long long start = now_ns();
+      if (queue->try_pop(taken)) {
+        pop_ns[next_pop->fetch_add(1)] = now_ns() - start;
+      }
+    });
+  }
+  return nullptr;
+}
+
+static void bench_vip_queue(int threads, long ops_per_thread) {
+  VipQueue queue;
+  Executor executor(threads, threads);
+  vector<long long> pop_ns(ops_per_thread * threads);
+  atomic<long> next_pop(0);
+  vector<VipArgs> producers(threads);
+  vector<pthread_t> tids(threads);
+
+  long long start = now_ns();
+  for (int i = 0; i < threads; i++) {
+    producers[i] = {&queue, &executor, ops_per_thread, (unsigned)(i + 1),
+                    {}, pop_ns.data(), &next_pop};
+    pthread_create(&tids[i], NULL, vip_producer, &producers[i]);
+  }
+  for (int i = 0; i < threads; i++) {
+    pthread_join(tids[i], NULL);
+  }
+  executor.wait_idle();
+  double seconds = (now_ns() - start) / 1e9;
+
+  Result push = {"vip_queue_push", params(threads, 0, 0),
+                 ops_per_thread * threads, seconds, {}};
+  for (int i = 0; i < threads; i++) {
+    push.latencies_ns.insert(push.latencies_ns.end(),
+                             producers[i].latencies_ns.begin(),
+                             producers[i].latencies_ns.end());
+  }
+  long popped = next_pop.load();
+  Result pop = {"vip_queue_pop", params(threads, 0, 0), popped, seconds,
+                vector<long long>(pop_ns.begin(), pop_ns.begin() + popped)};
+  report(push);
+  report(pop);
+}
+
+// ----- ReadWriteLock -----
+
+typedef struct LockArgs {
+  ReadWriteLock *lock;
+  long *shared;
+  long ops;
+  double write_ratio;
+  unsigned seed;
+  vector<long long> latencies_ns;
+} LockArgs;
+
+static void *lock_thread(void *arg) {
+  LockArgs *args = (LockArgs *)arg;
+  mt19937 rng(args->seed);
+  uniform_real_distribution<double> coin(0.0, 1.0);
+  long sink = 0;
+
+  args->latencies_ns.reserve(args->ops);
+  for (long i = 0; i < args->ops; i++) {
+    bool write = coin(rng) < args->write_ratio;
+    long long start = now_ns();
+    if (write) {
+      args->lock->writeLock();
+      (*args->shared)++;
+      args->lock->writeUnlock();
+    } else {
+      args->lock->readLock();
+      sink += *args->shared;
+      args->lock->readUnlock();
+    }
+    args->latencies_ns.push_back(now_ns() - start);
+  }
+  return (void *)sink;
+}
+
+static void bench_rwlock(int threads, double write_ratio, long ops_per_thread) {
+  ReadWriteLock lock;
+  long shared = 0;
+  vector<LockArgs> args(threads);
+  vector<pthread_t> tids(threads);
+
+  long long start = now_ns();
+  for (int i = 0; i < threads; i++) {
+    args[i] = {&lock, &shared, ops_per_thread, write_ratio, (unsigned)(i + 1), {}};
+    pthread_create(&tids[i], NULL, lock_thread, &args[i]);
+  }
+  for (int i = 0; i < threads; i++) {
+    pthread_join(tids[i], NULL);
+  }
+
+  ostringstream extra;
+  extra << ",\"threads\":" << threads << ",\"write_ratio\":" << write_ratio;
+  Result result = {"rwlock", extra.str(),
+                   ops_per_thread * threads, (now_ns() - start) / 1e9, {}};
+  for (int i = 0; i < threads; i++) {
+    result.latencies_ns.insert(result.latencies_ns.end(),
+                               args[i].latencies_ns.begin(),
+                               args[i].latencies_ns.end());
+  }
+  report(result);
+}
+
+int main(int argc, char *argv[]) {
+  bool quick = false;
+  long ops = 50000;
+  string out_path;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--quick") == 0) {
+      quick = true;
+      ops = 5000;
+    } else if (strcmp(argv[i], "--ops") == 0 && i + 1 < argc) {
+      ops = atol(argv[++i]);
+    } else if (strcmp(argv[i], "--out") == 0 && i + 1 < argc) {
+      out_path = argv[++i];
+    } else {
+      cerr << "usage: " << argv[0] << " [--quick] [--ops N] [--out FILE]"
+           << endl;
+      return 1;
+    }
+  }
+
+  // operation log lines are still formatted, just not kept
+  LogConfig log_config = {"/dev/null", LOG_ASYNC != 0, LOG_FLUSH_RECORDS,
+                          LOG_FLUSH_INTERVAL_MS, false};
+  Log::configure(log_config);
+  Log::getInstance();
+
+  vector<int> thread_counts = quick ? vector<int>{1, 4} : vector<int>{1, 2, 4, 8, 16};
+  vector<int> account_counts = quick ? vector<int>{1000} : vector<int>{100, 10000, 100000};
+  vector<double> contentions = {0.0, 0.9};
+
+  for (int op = OP_DEPOSIT; op <= OP_EXCHANGE; op++) {
+    for (int accounts : account_counts) {
+      for (double contention : contentions) {
+        for (int threads : thread_counts) {
+          bench_bank_op((BankOp)op, threads, accounts, contention, ops);
+        }
+      }
+    }
+  }
+
+  // every kernel level the CPU has, best one left in place afterwards
+  vector<KernelLevel> levels;
+  for (int level = KERNELS_SCALAR; level <= KERNELS_AVX2; level++) {
+    if (set_kernel_level((KernelLevel)level) == level) {
+      levels.push_back((KernelLevel)level);
+    }
+  }
+
+  vector<int> sweep_accounts = quick ? vector<int>{10000} : vector<int>{10000, 100000};
+  for (KernelLevel level : levels) {
+    set_kernel_level(level);
+    for (int accounts : sweep_accounts) {
+      bench_sweeps(accounts, accounts / 100, quick ? 10 : 50, level);
+    }
+    bench_kernels(level, ops * 4);
+  }
+
+  vector<int> checkpoint_accounts = quick ? vector<int>{100000} : vector<int>{100000, 2000000};
+  for (int accounts : checkpoint_accounts) {
+    bench_checkpoint(accounts, quick ? 1 : 3);
+  }
+
+  vector<int> payroll_sizes = quick ? vector<int>{1000} : vector<int>{100, 1000, 10000};
+  for (int payees : payroll_sizes) {
+    bench_payroll(payees, quick ? 20 : 100);
+  }
+
+  for (int threads : thread_counts) {
+    bench_vip_queue(threads, ops);
+  }
+
+  for (int threads : thread_counts) {
+    for (double write_ratio : {0.0, 0.1, 0.5}) {
+      bench_rwlock(threads, write_ratio, ops * 4);
+    }
+  }
+
+  ostringstream json;
+  json << "[\n";
+  for (size_t i = 0; i < results.size(); i++) {
+    json << "  " << results[i] << (i + 1 < results.size() ? ",\n" : "\n");
+  }
+  json << "]\n";
+
+  if (out_path.empty()) {
+    cout << json.str();
+  } else {
+    ofstream out(out_path.c_str());
+    out << json.str();
+  }
+  return 0;
+}
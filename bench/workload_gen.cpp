@@ -0,0 +1,288 @@
+// Synthetic ATM input files for throughput runs.
+// Writes <out-dir>/ATM<k>_IN.txt for k = 1..atms in the grammar parse_command
+// accepts. Each ATM first opens its share of the accounts, then issues a
+// random mix of commands whose account ids follow a Zipf distribution, so
+// a few accounts get most of the traffic.
+//
+//   ./workload_gen --atms 8 --commands 1000000 --accounts 10000 --zipf 1.1
+//       --vip 0.05 --mix D=30,W=20,B=20,T=15,X=10,I=2,S=2,O=0.5,Q=0.5
+//       --seed 1 --out-dir traces
+
+#include "command.h"
+#include <algorithm>
+#include <iostream>
+#include <math.h>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#define DEFAULT_MIX "D=30,W=20,B=20,T=15,X=10,I=2,S=2,O=0.5,Q=0.5"
+#define MAX_AMOUNT 1000
+#define WRITE_BUFFER (1 << 20)
+
+typedef struct Options {
+  int atms = 4;
+  long commands = 100000; // per ATM, not counting the opening lines
+  int accounts = 10000;
+  double zipf = 1.0;      // 0 is uniform
+  double vip = 0.0;       // fraction of commands marked VIP
+  int sleep_max_ms = 10;
+  int invest_max_ms = 1000;
+  unsigned seed = 1;
+  string mix = DEFAULT_MIX;
+  string out_dir = ".";
+} Options;
+
+// Account ids are 1..accounts, drawn by Zipf rank. Ranks are shuffled onto
+// ids so the hot accounts are spread over the id space (and the shards).
+class ZipfAccounts {
+public:
+  ZipfAccounts(int accounts, double skew, mt19937 &rng) : cdf(accounts), ids(accounts) {
+    double sum = 0;
+    for (int rank = 0; rank < accounts; rank++) {
+      sum += 1.0 / pow(rank + 1, skew);
+      cdf[rank] = sum;
+    }
+    for (int rank = 0; rank < accounts; rank++) {
+      cdf[rank] /= sum;
+      ids[rank] = rank + 1;
+    }
+    shuffle(ids.begin(), ids.end(), rng);
+  }
+
+  int next(mt19937 &rng) {
+    double u = uniform_real_distribution<double>(0.0, 1.0)(rng);
+    size_t rank = lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin();
+    return ids[min(rank, ids.size() - 1)];
+  }
+
+private:
+  vector<double> cdf;
+  vector<int> ids;
+};
+
+static int password_of(int account) {
+  return 1000 + account % 9000;
+}
+
+// "D=30,W=20" -> command letters and cumulative weights
+static bool parse_mix(const string &mix, string &letters, vector<double> &weights) {
+  const string known = "ODWBQTCRXIS";
+  double sum = 0;
+  size_t pos = 0;
+
+  while (pos < mix.size()) {
+    size_t comma = mix.find(',', pos);
+    string item = mix.substr(pos, comma == string::npos ? string::npos : comma - pos);
+    pos = (comma == string::npos) ? mix.size() : comma + 1;
+
+    if (item.size() < 3 || item[1] != '=' || known.find(item[0]) == string::npos) {
+      cerr << "bad mix entry '" << item << "'" << endl;
+      return false;
+    }
+    double weight = atof(item.c_str() + 2);
+    if (weight <= 0) {
+      continue;
+    }
+    sum += weight;
+    letters.push_back(item[0]);
+    weights.push_back(sum);
+  }
+  if (letters.empty()) {
+    cerr << "mix has no commands" << endl;
+    return false;
+  }
+  return true;
+}
+
+static CommandType type_of(char letter) {
+  switch (letter) {
+  case 'O': return CMD_OPEN;
+  case 'D': return CMD_DEPOSIT;
+  case 'W': return CMD_WITHDRAW;
+  case 'B': return CMD_BALANCE;
+  case 'Q': return CMD_CLOSE;
+  case 'T': return CMD_TRANSFER;
+  case 'C': return CMD_CLOSE_ATM;
+  case 'R': return CMD_ROLLBACK;
+  case 'X': return CMD_EXCHANGE;
+  case 'I': return CMD_INVEST;
+  default: return CMD_SLEEP;
+  }
+}
+
+static const char *currency(mt19937 &rng) {
+  return (rng() & 1) ? "ILS" : "USD";
+}
+
+// One command line for `letter`, without the newline
+static int format_command(char *line, size_t size, char letter, const Options &opt,
+                          ZipfAccounts &zipf, mt19937 &rng) {
+  uniform_int_distribution<int> amount(1, MAX_AMOUNT);
+  int account = zipf.next(rng);
+  int pass = password_of(account);
+
+  switch (letter) {
+  case 'O':
+    return snprintf(line, size, "O %d %d %d %d", account, pass, amount(rng) * 10,
+                    amount(rng) * 10);
+  case 'D':
+  case 'W':
+    return snprintf(line, size, "%c %d %d %d %s", letter, account, pass, amount(rng),
+                    currency(rng));
+  case 'B':
+  case 'Q':
+    return snprintf(line, size, "%c %d %d", letter, account, pass);
+  case 'T': {
+    int target = zipf.next(rng);
+    if (target == account) {
+      target = account % opt.accounts + 1; // no self transfers
+    }
+    return snprintf(line, size, "T %d %d %d %d %s", account, pass, target, amount(rng),
+                    currency(rng));
+  }
+  case 'C':
+    return snprintf(line, size, "C %d",
+                    uniform_int_distribution<int>(1, opt.atms)(rng));
+  case 'R':
+    return snprintf(line, size, "R %d", uniform_int_distribution<int>(1, 5)(rng));
+  case 'X': {
+    bool to_usd = rng() & 1;
+    return snprintf(line, size, "X %d %d %s to %s %d", account, pass,
+                    to_usd ? "ILS" : "USD", to_usd ? "USD" : "ILS", amount(rng));
+  }
+  case 'I':
+    return snprintf(line, size, "I %d %d %d %s %d", account, pass, amount(rng),
+                    currency(rng),
+                    uniform_int_distribution<int>(10, max(10, opt.invest_max_ms))(rng));
+  case 'S':
+    return snprintf(line, size, "S %d",
+                    uniform_int_distribution<int>(1, max(1, opt.sleep_max_ms))(rng));
+  }
+  return 0;
+}
+
+static bool write_atm_file(int atm, const Options &opt, const string &letters,
+                           const vector<double> &weights, ZipfAccounts &zipf) {
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/ATM%d_IN.txt", opt.out_dir.c_str(), atm);
+  FILE *file = fopen(path, "w");
+  if (!file) {
+    perror(path);
+    return false;
+  }
+  setvbuf(file, NULL, _IOFBF, WRITE_BUFFER);
+
+  mt19937 rng(opt.seed * 7919 + atm);
+  uniform_real_distribution<double> coin(0.0, 1.0);
+  uniform_real_distribution<double> pick(0.0, weights.back());
+  uniform_int_distribution<int> priority(1, 100);
+  char line[256];
+  Command cmd;
+
+  // every account is opened once, by the ATM that owns its residue
+  for (int account = atm; account <= opt.accounts; account += opt.atms) {
+    fprintf(file, "O %d %d %d %d\n", account, password_of(account), 100000, 50000);
+  }
+
+  for (long i = 0; i < opt.commands; i++) {
+    size_t kind = upper_bound(weights.begin(), weights.end(), pick(rng)) - weights.begin();
+    char letter = letters[min(kind, letters.size() - 1)];
+    int len = format_command(line, sizeof(line), letter, opt, zipf, rng);
+    if (opt.vip > 0 && letter != 'S' && coin(rng) < opt.vip) {
+      len += snprintf(line + len, sizeof(line) - len, " VIP=%d", priority(rng));
+    }
+
+    // the trace must be read back exactly as intended
+    parse_command(line, len, cmd);
+    if (cmd.type != type_of(letter)) {
+      fprintf(stderr, "generated an unparsable line: %s\n", line);
+      fclose(file);
+      return false;
+    }
+
+    line[len++] = '\n';
+    fwrite(line, 1, len, file);
+  }
+
+  if (fclose(file) != 0) {
+    perror(path);
+    return false;
+  }
+  return true;
+}
+
+static void usage(const char *prog) {
+  cerr << "usage: " << prog
+       << " [--atms N] [--commands N] [--accounts N] [--zipf S] [--vip F]\n"
+          "       [--mix " DEFAULT_MIX "]\n"
+          "       [--sleep-max MS] [--invest-max MS] [--seed N] [--out-dir DIR]"
+       << endl;
+}
+
+int main(int argc, char *argv[]) {
+  Options opt;
+
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+    if (arg == "--help") {
+      usage(argv[0]);
+      return 0;
+    }
+    if (i + 1 >= argc) {
+      usage(argv[0]);
+      return 1;
+    }
+    const char *value = argv[++i];
+    if (arg == "--atms") {
+      opt.atms = atoi(value);
+    } else if (arg == "--commands") {
+      opt.commands = atol(value);
+    } else if (arg == "--accounts") {
+      opt.accounts = atoi(value);
+    } else if (arg == "--zipf") {
+      opt.zipf = atof(value);
+    } else if (arg == "--vip") {
+      opt.vip = atof(value);
+    } else if (arg == "--mix") {
+      opt.mix = value;
+    } else if (arg == "--sleep-max") {
+      opt.sleep_max_ms = atoi(value);
+    } else if (arg == "--invest-max") {
+      opt.invest_max_ms = atoi(value);
+    } else if (arg == "--seed") {
+      opt.seed = (unsigned)atol(value);
+    } else if (arg == "--out-dir") {
+      opt.out_dir = value;
+    } else {
+      usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (opt.atms <= 0 || opt.accounts <= 0 || opt.commands < 0 || opt.zipf < 0) {
+    usage(argv[0]);
+    return 1;
+  }
+
+  string letters;
+  vector<double> weights;
+  if (!parse_mix(opt.mix, letters, weights)) {
+    return 1;
+  }
+
+  mt19937 rng(opt.seed);
+  ZipfAccounts zipf(opt.accounts, opt.zipf, rng);
+
+  for (int atm = 1; atm <= opt.atms; atm++) {
+    if (!write_atm_file(atm, opt, letters, weights, zipf)) {
+      return 1;
+    }
+  }
+  return 0;
+}
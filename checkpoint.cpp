@@ -0,0 +1,163 @@
+#include "checkpoint.h"
+#include "journal.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/********** CheckpointWriter **********/
+
+CheckpointWriter::CheckpointWriter() {
+  memset(&header, 0, sizeof(header));
+  header.magic = CHECKPOINT_MAGIC;
+  header.version = CHECKPOINT_VERSION;
+  header.shards = ACCOUNT_SHARDS;
+}
+
+void CheckpointWriter::add(int id, uint64_t word, const string &password) {
+  int32_t id32 = id;
+  uint8_t len = (uint8_t)(password.size() < 255 ? password.size() : 255);
+  ids.append((const char *)&id32, sizeof(id32));
+  balances.append((const char *)&word, sizeof(word));
+  password_lens.append((const char *)&len, sizeof(len));
+  passwords.append(password, 0, len);
+  header.accounts++;
+}
+
+void CheckpointWriter::set_bank_balance(const int *balance) {
+  for (int curr = 0; curr < NUM_CURRENCIES; curr++) {
+    header.bank_balance[curr] = balance[curr];
+  }
+}
+
+static bool write_all(int fd, const string &data) {
+  const char *buf = data.data();
+  size_t len = data.size();
+  while (len > 0) {
+    ssize_t n = ::write(fd, buf, len);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    buf += n;
+    len -= n;
+  }
+  return true;
+}
+
+bool CheckpointWriter::write(const string &path) {
+  header.passwords_size = passwords.size();
+  uint32_t check = 0;
+  for (const string *part : {&ids, &balances, &password_lens, &passwords}) {
+    // chained, so the parts can't be swapped around unnoticed
+    check = journal_checksum(part->data(), part->size()) ^ (check * 16777619u);
+  }
+  header.check = check;
+
+  string tmp_path = path + ".tmp";
+  int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  string head((const char *)&header, sizeof(header));
+  bool written = write_all(fd, head) && write_all(fd, ids) &&
+                 write_all(fd, balances) && write_all(fd, password_lens) &&
+                 write_all(fd, passwords) && fdatasync(fd) == 0;
+  int saved = errno;
+  close(fd);
+  if (!written || rename(tmp_path.c_str(), path.c_str()) != 0) {
+    saved = written ? errno : saved;
+    unlink(tmp_path.c_str());
+    errno = saved;
+    return false;
+  }
+
+  // make the rename itself durable
+  string dir_path = path;
+  int dir = open(dirname(&dir_path[0]), O_RDONLY);
+  if (dir >= 0) {
+    fsync(dir);
+    close(dir);
+  }
+  return true;
+}
+
+/********** CheckpointFile **********/
+
+CheckpointFile::CheckpointFile()
+    : data(nullptr), size(0), header(nullptr), ids(nullptr),
+      balances(nullptr), password_lens(nullptr), passwords(nullptr) {}
+
+CheckpointFile::~CheckpointFile() {
+  if (data != nullptr) {
+    munmap((void *)data, size);
+  }
+}
+
+bool CheckpointFile::open(const string &path) {
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0) {
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return false;
+  }
+  if ((size_t)st.st_size < sizeof(CheckpointHeader)) {
+    close(fd);
+    errno = EINVAL;
+    return false;
+  }
+
+  void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  int saved = errno;
+  close(fd); // the mapping keeps the file alive
+  if (addr == MAP_FAILED) {
+    errno = saved;
+    return false;
+  }
+  data = (const char *)addr;
+  size = st.st_size;
+  madvise(addr, size, MADV_SEQUENTIAL);
+
+  header = (const CheckpointHeader *)data;
+  uint64_t accounts = header->accounts;
+  uint64_t ids_size = accounts * sizeof(int32_t);
+  uint64_t balances_size = accounts * sizeof(uint64_t);
+  uint64_t expected = sizeof(CheckpointHeader) + ids_size + balances_size +
+                      accounts + header->passwords_size;
+  if (header->magic != CHECKPOINT_MAGIC ||
+      header->version != CHECKPOINT_VERSION ||
+      header->shards != ACCOUNT_SHARDS || expected != size) {
+    errno = EINVAL;
+    return false;
+  }
+
+  ids = (const int32_t *)(data + sizeof(CheckpointHeader));
+  balances = (const char *)ids + ids_size;
+  password_lens = (const uint8_t *)(balances + balances_size);
+  passwords = (const char *)password_lens + accounts;
+
+  uint32_t check = 0;
+  const char *part = (const char *)ids;
+  for (uint64_t part_size : {ids_size, balances_size, accounts, header->passwords_size}) {
+    check = journal_checksum(part, part_size) ^ (check * 16777619u);
+    part += part_size;
+  }
+  uint64_t password_total = 0;
+  for (uint64_t i = 0; i < accounts; i++) {
+    password_total += password_lens[i];
+  }
+  if (check != header->check || password_total != header->passwords_size) {
+    errno = EINVAL;
+    return false;
+  }
+  return true;
+}
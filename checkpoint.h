@@ -0,0 +1,107 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "account_table.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+
+using namespace std;
+
+// Full bank state in one file, for restarts that don't replay every
+// account's history (BANK_CHECKPOINT=<file>). Layout, in host byte order:
+//   header            CheckpointHeader
+//   ids               int32[accounts]
+//   balances          uint64[accounts] - packed like the slab words
+//   password lengths  uint8[accounts]
+//   passwords         the bytes, back to back
+// Each shard was copied under its write lock, together with the journal
+// offset at that moment: journal records of the shard's accounts before
+// that offset are already in the checkpoint, the ones after it are not.
+
+#ifndef CHECKPOINT_ITERATIONS
+#define CHECKPOINT_ITERATIONS 100 // bank thread iterations (~1 s) between checkpoints
+#endif
+
+#define CHECKPOINT_MAGIC 0x504B4342 // "BCKP"
+#define CHECKPOINT_VERSION 1
+
+typedef struct CheckpointHeader {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t shards; // ACCOUNT_SHARDS of the writer
+  uint32_t accounts;
+  int32_t bank_balance[NUM_CURRENCIES];
+  uint64_t passwords_size;
+  uint64_t journal_offset[ACCOUNT_SHARDS];
+  uint32_t check; // of everything after the header
+  uint32_t pad;
+} CheckpointHeader;
+
+// Collects the state shard by shard, then writes it in one go
+class CheckpointWriter {
+private:
+  CheckpointHeader header;
+  string ids;
+  string balances;
+  string password_lens;
+  string passwords;
+
+public:
+  CheckpointWriter();
+
+  void add(int id, uint64_t balances, const string &password);
+  void set_journal_offset(int shard, uint64_t offset) {
+    header.journal_offset[shard] = offset;
+  }
+  void set_bank_balance(const int *balance);
+
+  // To path.tmp, synced, then renamed over path - a crash leaves either
+  // the old checkpoint or the new one. False with errno set on failure.
+  bool write(const string &path);
+};
+
+// Read-only view of a checkpoint file, memory mapped
+class CheckpointFile {
+private:
+  const char *data;
+  size_t size;
+  const CheckpointHeader *header;
+  const int32_t *ids;
+  const char *balances; // uint64s, possibly unaligned
+  const uint8_t *password_lens;
+  const char *passwords;
+
+  CheckpointFile(const CheckpointFile &) = delete;
+  CheckpointFile &operator=(const CheckpointFile &) = delete;
+
+public:
+  CheckpointFile();
+  ~CheckpointFile();
+
+  // False with errno set if it can't be read, EINVAL if it is not a
+  // whole checkpoint of this build's layout
+  bool open(const string &path);
+
+  int accounts() const { return header->accounts; }
+  const int *bank_balance() const { return header->bank_balance; }
+  uint64_t journal_offset(int shard) const { return header->journal_offset[shard]; }
+
+  // Calls visit(id, balance, password, password length) for every account
+  template <typename Visit> void for_each(Visit visit) const;
+};
+
+template <typename Visit> void CheckpointFile::for_each(Visit visit) const {
+  const char *password = passwords;
+  for (uint32_t i = 0; i < header->accounts; i++) {
+    uint64_t word;
+    memcpy(&word, balances + i * sizeof(word), sizeof(word));
+    int balance[NUM_CURRENCIES];
+    Account::unpack(word, balance);
+    visit(ids[i], (const int *)balance, password, (size_t)password_lens[i]);
+    password += password_lens[i];
+  }
+}
+
+#endif
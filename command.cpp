@@ -0,0 +1,210 @@
+#include "command.h"
+#include <limits.h>
+#include <string.h>
+
+// Cursor over the whitespace separated tokens of a line
+typedef struct Tokens {
+    const char *pos;
+    const char *end;
+    bool illegal; // an argument was out of range or unknown
+} Tokens;
+
+static bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n' || c == '\v' ||
+           c == '\f';
+}
+
+static bool is_vip_token(const char *begin, const char *end) {
+    return end - begin >= 4 && memcmp(begin, "VIP=", 4) == 0;
+}
+
+// Next argument token, VIP=<n> markers are skipped wherever they appear
+static bool next_token(Tokens &tokens, const char *&begin, const char *&end) {
+    while (true) {
+        while (tokens.pos < tokens.end && is_space(*tokens.pos)) {
+            tokens.pos++;
+        }
+        if (tokens.pos == tokens.end) {
+            return false;
+        }
+        begin = tokens.pos;
+        while (tokens.pos < tokens.end && !is_space(*tokens.pos)) {
+            tokens.pos++;
+        }
+        end = tokens.pos;
+        if (!is_vip_token(begin, end)) {
+            return true;
+        }
+    }
+}
+
+// Leading integer of [begin, end), 0 if there is none (like operator>>).
+// False if it doesn't fit in an int.
+static bool to_int(const char *begin, const char *end, int &value) {
+    bool negative = false;
+    long long magnitude = 0;
+    long long limit = (long long)INT_MAX;
+
+    if (begin < end && (*begin == '-' || *begin == '+')) {
+        negative = (*begin == '-');
+        begin++;
+    }
+    if (negative) {
+        limit++; // -INT_MIN
+    }
+    while (begin < end && *begin >= '0' && *begin <= '9') {
+        magnitude = magnitude * 10 + (*begin - '0');
+        if (magnitude > limit) {
+            value = 0;
+            return false;
+        }
+        begin++;
+    }
+    value = (int)(negative ? -magnitude : magnitude);
+    return true;
+}
+
+static int next_int(Tokens &tokens) {
+    const char *begin, *end;
+    int value = 0;
+    if (next_token(tokens, begin, end) && !to_int(begin, end, value)) {
+        tokens.illegal = true;
+    }
+    return value;
+}
+
+static Currency next_currency(Tokens &tokens) {
+    const char *begin, *end;
+    if (next_token(tokens, begin, end)) {
+        size_t len = end - begin;
+        for (int c = 0; c < NUM_CURRENCIES; c++) {
+            const string &name = currency_name((Currency)c);
+            if (len == name.size() && memcmp(begin, name.data(), len) == 0) {
+                return (Currency)c;
+            }
+        }
+    }
+    tokens.illegal = true; // missing or unknown currency
+    return CURR_USD;
+}
+
+static void next_password(Tokens &tokens, char *password) {
+    const char *begin, *end;
+    size_t len = 0;
+
+    if (next_token(tokens, begin, end)) {
+        len = end - begin;
+        if (len > MAX_PASSWORD_LEN) { // never compare a cut password
+            tokens.illegal = true;
+            len = 0;
+        }
+        memcpy(password, begin, len);
+    }
+    password[len] = '\0';
+}
+
+static void skip_token(Tokens &tokens) {
+    const char *begin, *end;
+    next_token(tokens, begin, end);
+}
+
+bool parse_command(const char *line, size_t len, Command &cmd) {
+    Tokens tokens = {line, line + len, false};
+    const char *begin, *end;
+
+    cmd.vip_priority = 0; // vip is between (1,100)
+    cmd.atm_id = 0;
+    cmd.account = cmd.target = cmd.amount = 0;
+    cmd.ils = cmd.usd = cmd.time = 0;
+    cmd.currency = cmd.target_currency = CURR_USD;
+    cmd.password[0] = '\0';
+
+    // VIP marker can be anywhere on the line
+    for (const char *p = line; p + 4 <= line + len; p++) {
+        if ((p == line || is_space(p[-1])) && memcmp(p, "VIP=", 4) == 0) {
+            const char *q = p + 4;
+            while (q < line + len && !is_space(*q)) {
+                q++;
+            }
+            if (!to_int(p + 4, q, cmd.vip_priority)) {
+                tokens.illegal = true;
+            }
+        }
+    }
+
+    char type_char = '\0';
+    if (next_token(tokens, begin, end)) {
+        type_char = *begin;
+        tokens.pos = begin + 1; // arguments may follow the letter directly
+    }
+
+    switch (type_char) {
+    case 'O':
+        cmd.type = CMD_OPEN;
+        cmd.account = next_int(tokens);
+        next_password(tokens, cmd.password);
+        cmd.ils = next_int(tokens);
+        cmd.usd = next_int(tokens);
+        break;
+    case 'D':
+    case 'W':
+        cmd.type = (type_char == 'D') ? CMD_DEPOSIT : CMD_WITHDRAW;
+        cmd.account = next_int(tokens);
+        next_password(tokens, cmd.password);
+        cmd.amount = next_int(tokens);
+        cmd.currency = next_currency(tokens);
+        break;
+    case 'B':
+    case 'Q':
+        cmd.type = (type_char == 'B') ? CMD_BALANCE : CMD_CLOSE;
+        cmd.account = next_int(tokens);
+        next_password(tokens, cmd.password);
+        break;
+    case 'T':
+        cmd.type = CMD_TRANSFER;
+        cmd.account = next_int(tokens);
+        next_password(tokens, cmd.password);
+        cmd.target = next_int(tokens);
+        cmd.amount = next_int(tokens);
+        cmd.currency = next_currency(tokens);
+        break;
+    case 'C':
+        cmd.type = CMD_CLOSE_ATM;
+        cmd.target = next_int(tokens);
+        break;
+    case 'R':
+        cmd.type = CMD_ROLLBACK;
+        cmd.amount = next_int(tokens);
+        break;
+    case 'X':
+        cmd.type = CMD_EXCHANGE;
+        cmd.account = next_int(tokens);
+        next_password(tokens, cmd.password);
+        cmd.currency = next_currency(tokens);
+        skip_token(tokens); // "to"
+        cmd.target_currency = next_currency(tokens);
+        cmd.amount = next_int(tokens);
+        break;
+    case 'I':
+        cmd.type = CMD_INVEST;
+        cmd.account = next_int(tokens);
+        next_password(tokens, cmd.password);
+        cmd.amount = next_int(tokens);
+        cmd.currency = next_currency(tokens);
+        cmd.time = next_int(tokens);
+        break;
+    case 'S':
+        cmd.type = CMD_SLEEP;
+        cmd.time = next_int(tokens);
+        break;
+    default:
+        cmd.type = CMD_OPEN; // error handling
+        break;
+    }
+
+    if (tokens.illegal) {
+        cmd.type = CMD_INVALID;
+        return false;
+    }
+    return true;
+}
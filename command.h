@@ -1,15 +1,19 @@
 #ifndef COMMANDS_H
 #define COMMANDS_H
 
-#include <vector>
+#include "currency.h"
+#include <stddef.h>
 #include <string>
 
 using namespace std;
 
+#define MAX_PASSWORD_LEN 31 // a longer password makes the line illegal
+
 enum CommandType {
     CMD_OPEN, CMD_DEPOSIT, CMD_WITHDRAW, CMD_BALANCE, CMD_CLOSE,
     CMD_TRANSFER, CMD_CLOSE_ATM, CMD_ROLLBACK, CMD_EXCHANGE, CMD_INVEST,
-    CMD_SLEEP
+    CMD_SLEEP,
+    CMD_INVALID // illegal arguments, nothing runs
 };
 
 enum CommandStatus {
@@ -17,11 +21,36 @@ enum CommandStatus {
     COMMAND_FAILED = 1
 };
 
+// A fully parsed input line. Which arguments are set depends on the type:
+//   O account password ils usd
+//   D/W account password amount currency
+//   B/Q account password
+//   T account password target amount currency
+//   C target                       (target ATM)
+//   R amount                       (iterations)
+//   X account password currency to target_currency amount
+//   I account password amount currency time
+//   S time                         (ms)
 typedef struct Command {
     CommandType type;
     int vip_priority;
-    string cmd_string;
     int atm_id; // for vip commands
+
+    int account;
+    int target;
+    int amount;
+    int ils;
+    int usd;
+    int time;
+    Currency currency;
+    Currency target_currency;
+    char password[MAX_PASSWORD_LEN + 1];
 } Command;
 
+// Parses one input line in a single pass, without allocating.
+// Missing numeric arguments read as 0, any currency other than ILS as USD.
+// A password longer than MAX_PASSWORD_LEN or a number that doesn't fit in
+// an int makes the line illegal: returns false with the type CMD_INVALID.
+bool parse_command(const char *line, size_t len, Command &cmd);
+
 #endif
\ No newline at end of file
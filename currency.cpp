@@ -0,0 +1,15 @@
+#include "currency.h"
+
+const int currency_rate[NUM_CURRENCIES] = {
+    1, // ILS
+    5, // USD - 1 USD = 5 ILS
+};
+
+const string &currency_name(Currency curr) {
+    static const string names[NUM_CURRENCIES] = {"ILS", "USD"};
+    return names[curr];
+}
+
+int convert_currency(int s_amount, Currency s_curr, Currency t_curr) {
+    return s_amount * currency_rate[s_curr] / currency_rate[t_curr];
+}
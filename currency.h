@@ -0,0 +1,22 @@
+#ifndef CURRENCY_H
+#define CURRENCY_H
+
+#include <string>
+
+using namespace std;
+
+// Adding a currency - a new enum value plus its entries in currency.cpp
+enum Currency {
+    CURR_ILS = 0,
+    CURR_USD = 1,
+    NUM_CURRENCIES
+};
+
+extern const int currency_rate[NUM_CURRENCIES]; // value of one unit in ILS
+
+const string &currency_name(Currency curr);
+
+// Amount received for s_amount of s_curr, rounded down
+int convert_currency(int s_amount, Currency s_curr, Currency t_curr);
+
+#endif
@@ -0,0 +1,219 @@
+#include "executor.h"
+#include "instrument.h"
+#include <unistd.h>
+
+// the worker the current thread is, nullptr outside the workers
+static thread_local void *current_worker = nullptr;
+
+Executor::Executor(int num_threads, int urgent_lanes)
+    : queued(0), pending(0), sleeping(0), next_worker(0), urgent_waiting(0),
+      urgent_running(0), urgent_lanes(urgent_lanes), running(true) {
+  pthread_mutex_init(&lock, NULL);
+  pthread_cond_init(&work_cond, NULL);
+  pthread_cond_init(&idle_cond, NULL);
+
+  if (num_threads <= 0) {
+    num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_threads > EXECUTOR_MAX_THREADS) {
+      num_threads = EXECUTOR_MAX_THREADS;
+    }
+    if (num_threads < 1) {
+      num_threads = 1;
+    }
+  }
+
+  // every queue exists before any worker may steal from it
+  for (int i = 0; i < num_threads; i++) {
+    Worker *worker = new Worker;
+    pthread_mutex_init(&worker->lock, NULL);
+    worker->executor = this;
+    worker->index = i;
+    workers.push_back(worker);
+  }
+  for (size_t i = 0; i < workers.size(); i++) {
+    if (pthread_create(&workers[i]->thread, NULL, worker_func, workers[i]) != 0) {
+      // tasks queued to it get stolen by the others
+      workers[i]->thread = 0;
+    }
+  }
+}
+
+Executor::~Executor() {
+  timers.drain(); // delayed tasks still go to the queues
+
+  pthread_mutex_lock(&lock);
+  running = false;
+  pthread_cond_broadcast(&work_cond);
+  pthread_mutex_unlock(&lock);
+
+  for (Worker *worker : workers) {
+    if (worker->thread != 0) {
+      pthread_join(worker->thread, NULL);
+    }
+  }
+  for (Worker *worker : workers) {
+    pthread_mutex_destroy(&worker->lock);
+    delete worker;
+  }
+  pthread_mutex_destroy(&lock);
+  pthread_cond_destroy(&work_cond);
+  pthread_cond_destroy(&idle_cond);
+}
+
+// Wakes a sleeping worker, if there is one. Callers changed queued or the
+// urgent lane first: a worker about to sleep either sees the change or is
+// counted in sleeping already.
+void Executor::wake() {
+  if (sleeping.load() > 0) {
+    pthread_mutex_lock(&lock);
+    pthread_cond_signal(&work_cond);
+    pthread_mutex_unlock(&lock);
+  }
+}
+
+void Executor::push(const Task &task) {
+  Worker *worker = (Worker *)current_worker;
+  if (worker == nullptr || worker->executor != this) {
+    worker = workers[next_worker.fetch_add(1) % workers.size()];
+  }
+
+  queued.fetch_add(1); // before the task shows up, thieves decrement it
+  pthread_mutex_lock(&worker->lock);
+  worker->tasks.push_back(task);
+  pthread_mutex_unlock(&worker->lock);
+  wake();
+}
+
+void Executor::submit(const Task &task) {
+  pending.fetch_add(1);
+  push(task);
+}
+
+void Executor::submit_after(int delay_ms, const Task &task) {
+  pending.fetch_add(1);
+  timers.schedule_after(delay_ms, [this, task]() { push(task); });
+}
+
+void Executor::submit_urgent(const Task &task) {
+  if (urgent_lanes <= 0) {
+    return;
+  }
+  pending.fetch_add(1);
+
+  pthread_mutex_lock(&lock);
+  urgent.push_back(task);
+  urgent_waiting.fetch_add(1);
+  if (sleeping.load() > 0 && urgent_running < urgent_lanes) {
+    pthread_cond_signal(&work_cond);
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+// The next task for self: urgent ones first, then its own queue from the
+// front, then the others' queues from the back
+bool Executor::take(Worker *self, Task &task, bool &is_urgent) {
+  if (urgent_waiting.load() > 0) {
+    pthread_mutex_lock(&lock);
+    if (!urgent.empty() && urgent_running < urgent_lanes) {
+      task.swap(urgent.front());
+      urgent.pop_front();
+      urgent_waiting.fetch_sub(1);
+      urgent_running++;
+      is_urgent = true;
+    }
+    pthread_mutex_unlock(&lock);
+    if (is_urgent) {
+      return true;
+    }
+  }
+
+  if (queued.load() <= 0) {
+    return false;
+  }
+
+  pthread_mutex_lock(&self->lock);
+  if (!self->tasks.empty()) {
+    task.swap(self->tasks.front());
+    self->tasks.pop_front();
+    pthread_mutex_unlock(&self->lock);
+    queued.fetch_sub(1);
+    return true;
+  }
+  pthread_mutex_unlock(&self->lock);
+
+  size_t count = workers.size();
+  for (size_t i = 1; i < count; i++) {
+    Worker *victim = workers[(self->index + i) % count];
+    pthread_mutex_lock(&victim->lock);
+    if (!victim->tasks.empty()) {
+      task.swap(victim->tasks.back());
+      victim->tasks.pop_back();
+      pthread_mutex_unlock(&victim->lock);
+      queued.fetch_sub(1);
+      return true;
+    }
+    pthread_mutex_unlock(&victim->lock);
+  }
+  return false;
+}
+
+bool Executor::has_work() {
+  return queued.load() > 0 || (!urgent.empty() && urgent_running < urgent_lanes);
+}
+
+void Executor::done() {
+  if (pending.fetch_sub(1) == 1) {
+    pthread_mutex_lock(&lock);
+    pthread_cond_broadcast(&idle_cond);
+    pthread_mutex_unlock(&lock);
+  }
+}
+
+void Executor::work(Worker *self) {
+  current_worker = self;
+
+  while (true) {
+    Task task;
+    bool is_urgent = false;
+    if (take(self, task, is_urgent)) {
+      task();
+      if (is_urgent) {
+        pthread_mutex_lock(&lock);
+        urgent_running--;
+        if (!urgent.empty()) {
+          pthread_cond_signal(&work_cond); // the lane is free again
+        }
+        pthread_mutex_unlock(&lock);
+      }
+      done();
+      continue;
+    }
+
+    pthread_mutex_lock(&lock);
+    sleeping.fetch_add(1);
+    while (running && !has_work()) {
+      pthread_cond_wait(&work_cond, &lock);
+    }
+    sleeping.fetch_sub(1);
+    bool stop = !running;
+    pthread_mutex_unlock(&lock);
+    if (stop) {
+      return;
+    }
+  }
+}
+
+void *Executor::worker_func(void *arg) {
+  Worker *worker = (Worker *)arg;
+  INST_THREAD_NAME("worker", worker->index);
+  worker->executor->work(worker);
+  return nullptr;
+}
+
+void Executor::wait_idle() {
+  pthread_mutex_lock(&lock);
+  while (pending.load() > 0) {
+    pthread_cond_wait(&idle_cond, &lock);
+  }
+  pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,80 @@
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include "timer_queue.h"
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <pthread.h>
+#include <vector>
+
+using namespace std;
+
+#define EXECUTOR_MAX_THREADS 64
+
+// Fixed set of work-stealing threads for the ATMs' commands.
+// Every worker has its own queue: tasks submitted from a worker go to the
+// back of its queue and it takes them from the front, so task streams that
+// resubmit themselves take turns. Idle workers steal from the back of the
+// other queues before they go to sleep.
+//
+// Urgent tasks (VIP commands) run before any queued task, but at most
+// urgent_lanes of them at once, like the VIP threads they replace.
+class Executor {
+public:
+  typedef function<void()> Task;
+
+private:
+  typedef struct Worker {
+    pthread_t thread;
+    pthread_mutex_t lock; // tasks
+    deque<Task> tasks;
+    Executor *executor;
+    int index;
+  } Worker;
+
+  vector<Worker *> workers;
+  atomic<int> queued;     // tasks in the worker queues
+  atomic<long> pending;   // submitted, delayed or running - not done yet
+  atomic<int> sleeping;   // workers waiting for work
+  atomic<unsigned> next_worker; // for submits from outside the workers
+
+  pthread_mutex_t lock; // urgent lane, sleeping workers, idle waiters
+  pthread_cond_t work_cond;
+  pthread_cond_t idle_cond;
+  deque<Task> urgent;
+  atomic<int> urgent_waiting; // urgent.size(), read without the lock
+  int urgent_running;
+  int urgent_lanes;
+  bool running;
+
+  TimerQueue timers; // submit_after(), drained before the workers stop
+
+  Executor(const Executor &) = delete;
+  Executor &operator=(const Executor &) = delete;
+
+  void push(const Task &task);
+  bool take(Worker *self, Task &task, bool &is_urgent);
+  bool has_work(); // with lock held
+  void wake();
+  void done();
+  void work(Worker *self);
+  static void *worker_func(void *arg);
+
+public:
+  // 0 threads - one per online CPU, capped
+  explicit Executor(int num_threads = 0, int urgent_lanes = 1);
+  ~Executor(); // queued tasks are dropped, see wait_idle()
+
+  int size() const { return (int)workers.size(); }
+
+  void submit(const Task &task);
+  void submit_after(int delay_ms, const Task &task);
+  // Dropped if there are no urgent lanes
+  void submit_urgent(const Task &task);
+
+  // Returns once every task is done, including the ones they submitted
+  void wait_idle();
+};
+
+#endif
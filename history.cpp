@@ -0,0 +1,81 @@
+#include "history.h"
+#include <algorithm>
+
+static bool record_id_less(const AccountRecord &record, int id) {
+  return record->id < id;
+}
+
+static bool record_less(const AccountRecord &a, const AccountRecord &b) {
+  return a->id < b->id;
+}
+
+History::History(int depth) : slots(depth > 0 ? depth : 1), head(0), count(0) {}
+
+const Status &History::slot_at(int index) const {
+  return slots[(head + index) % slots.size()];
+}
+
+const Status &History::at_age(int age) const {
+  return slot_at(count - 1 - age);
+}
+
+void History::push(Status &&status) {
+  int capacity = (int)slots.size();
+
+  // sorted so single accounts can be looked up with a binary search
+  sort(status.changed.begin(), status.changed.end(), record_less);
+  sort(status.removed.begin(), status.removed.end());
+
+  if (count == capacity) {
+    // fold the oldest iteration into the base and reuse its slot
+    apply(base, slots[head]);
+    slots[head] = std::move(status);
+    head = (head + 1) % capacity;
+    return;
+  }
+
+  slots[(head + count) % capacity] = std::move(status);
+  count++;
+}
+
+AccountRecord History::record_at_age(int age, int account_id) const {
+  // newest iteration that touched the account wins
+  for (int i = count - 1 - age; i >= 0; i--) {
+    const Status &status = slot_at(i);
+
+    auto it = lower_bound(status.changed.begin(), status.changed.end(),
+                          account_id, record_id_less);
+    if (it != status.changed.end() && (*it)->id == account_id) {
+      return *it;
+    }
+    if (binary_search(status.removed.begin(), status.removed.end(),
+                      account_id)) {
+      return nullptr;
+    }
+  }
+
+  auto it = base.find(account_id);
+  return (it != base.end()) ? it->second : nullptr;
+}
+
+void History::drop_newest(int iterations) {
+  int capacity = (int)slots.size();
+
+  while (iterations > 0 && count > 0) {
+    Status &newest = slots[(head + count - 1) % capacity];
+    newest.changed.clear();
+    newest.removed.clear();
+    count--;
+    iterations--;
+  }
+}
+
+// Replays one bank iteration on top of a full account state
+void History::apply(map<int, AccountRecord> &state, const Status &status) {
+  for (int id : status.removed) {
+    state.erase(id);
+  }
+  for (auto const &record : status.changed) {
+    state[record->id] = record;
+  }
+}
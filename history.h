@@ -0,0 +1,66 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include "currency.h"
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+#ifndef HISTORY_DEPTH
+#define HISTORY_DEPTH 100 // bank iterations kept for rollback
+#endif
+
+typedef struct AccountData {
+  int id;
+  string password;
+  int balance[NUM_CURRENCIES];
+} AccountData;
+
+// Snapshot records are immutable and shared between history entries
+typedef shared_ptr<const AccountData> AccountRecord;
+
+// One bank iteration - only the accounts that changed since the previous one
+typedef struct Status {
+  vector<AccountRecord> changed; // opened or modified accounts, by id
+  vector<int> removed;           // closed accounts, applied before changed
+} Status;
+
+// Fixed capacity circular store of the last bank iterations.
+// Appending and evicting are O(1) in the number of stored iterations: the
+// evicted iteration is folded into a base state and its slot is reused.
+// The full state after any stored iteration is the base with every older
+// stored iteration applied on top of it.
+class History {
+private:
+  vector<Status> slots;
+  int head;  // slot of the oldest iteration
+  int count; // stored iterations
+  map<int, AccountRecord> base; // state before the oldest iteration
+
+  const Status &slot_at(int index) const; // 0 = oldest
+
+public:
+  explicit History(int depth = HISTORY_DEPTH);
+
+  int size() const { return count; }
+  int capacity() const { return (int)slots.size(); }
+
+  // age 0 is the newest iteration, age size()-1 the oldest
+  const Status &at_age(int age) const;
+
+  void push(Status &&status);
+
+  // One account right after the iteration of the given age,
+  // nullptr if it did not exist then
+  AccountRecord record_at_age(int age, int account_id) const;
+
+  // Forget the newest iterations (rolled back history)
+  void drop_newest(int iterations);
+
+  static void apply(map<int, AccountRecord> &state, const Status &status);
+};
+
+#endif
@@ -0,0 +1,120 @@
+#include "input_file.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+InputFile::InputFile()
+    : data(nullptr), size(0), pos(0), prefetched(0), mapped(false),
+      opened(false) {}
+
+InputFile::~InputFile() { close(); }
+
+bool InputFile::open(const string &path) {
+  close();
+
+  int fd = ::open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+    void *addr = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr != MAP_FAILED) {
+      data = (const char *)addr;
+      size = st.st_size;
+      mapped = true;
+      madvise(addr, size, MADV_SEQUENTIAL);
+    }
+  }
+
+  if (!mapped && !read_all(fd)) {
+    ::close(fd);
+    return false;
+  }
+
+  ::close(fd); // the mapping keeps the file alive
+  opened = true;
+  prefetch();
+  return true;
+}
+
+// Fallback for files mmap() does not support (pipes, empty files...)
+bool InputFile::read_all(int fd) {
+  string content;
+  char chunk[64 * 1024];
+
+  while (true) {
+    ssize_t n = read(fd, chunk, sizeof(chunk));
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    if (n == 0) {
+      break;
+    }
+    content.append(chunk, n);
+  }
+
+  char *buffer = new char[content.size() + 1];
+  memcpy(buffer, content.data(), content.size());
+  data = buffer;
+  size = content.size();
+  return true;
+}
+
+void InputFile::close() {
+  if (data != nullptr) {
+    if (mapped) {
+      munmap((void *)data, size);
+    } else {
+      delete[] data;
+    }
+  }
+  data = nullptr;
+  size = pos = prefetched = 0;
+  mapped = false;
+  opened = false;
+}
+
+// Keep the kernel reading one window ahead of the cursor
+void InputFile::prefetch() {
+  if (!mapped || prefetched >= size || pos + INPUT_PREFETCH_WINDOW / 2 < prefetched) {
+    return;
+  }
+
+  long page = sysconf(_SC_PAGESIZE);
+  size_t start = prefetched & ~((size_t)page - 1);
+  size_t len = INPUT_PREFETCH_WINDOW;
+  if (start + len > size) {
+    len = size - start;
+  }
+  madvise((void *)(data + start), len, MADV_WILLNEED);
+  prefetched = start + len;
+}
+
+bool InputFile::next_line(const char *&line, size_t &len) {
+  if (pos >= size) {
+    return false;
+  }
+
+  const char *begin = data + pos;
+  const char *newline = (const char *)memchr(begin, '\n', size - pos);
+
+  line = begin;
+  if (newline != nullptr) {
+    len = newline - begin;
+    pos += len + 1;
+  } else {
+    len = size - pos; // last line without a newline
+    pos = size;
+  }
+
+  prefetch();
+  return true;
+}
@@ -0,0 +1,43 @@
+#ifndef INPUT_FILE_H
+#define INPUT_FILE_H
+
+#include <stddef.h>
+#include <string>
+
+using namespace std;
+
+#define INPUT_PREFETCH_WINDOW (4 * 1024 * 1024) // read-ahead hint size
+
+// Read-only view of an ATM input file.
+// The file is memory mapped and handed out line by line as pointers into
+// the mapping, so no per line copy is made. Lines follow getline() rules:
+// '\n' is stripped and a trailing newline does not add an empty line.
+// Files that cannot be mapped are read into one buffer instead.
+class InputFile {
+private:
+  const char *data;
+  size_t size;
+  size_t pos;
+  size_t prefetched; // end of the range already hinted with MADV_WILLNEED
+  bool mapped;
+  bool opened;
+
+  InputFile(const InputFile &) = delete;
+  InputFile &operator=(const InputFile &) = delete;
+
+  bool read_all(int fd);
+  void prefetch();
+
+public:
+  InputFile();
+  ~InputFile();
+
+  bool open(const string &path);
+  void close();
+  bool is_open() const { return opened; }
+
+  // The view stays valid until close()
+  bool next_line(const char *&line, size_t &len);
+};
+
+#endif
@@ -0,0 +1,246 @@
+#include "instrument.h"
+
+#ifdef BANK_INSTRUMENT
+
+#include <atomic>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+using namespace std;
+
+#define INST_BUCKETS 64 // bucket b holds [2^b, 2^(b+1)) ns
+#define INST_MAX_HELD 16 // locks one thread holds at once (transfer: 5)
+
+// Written by the owning thread only, read by the dumper while it runs
+typedef struct Histogram {
+  atomic<unsigned long long> count;
+  atomic<unsigned long long> total_ns;
+  atomic<unsigned long long> max_ns;
+  atomic<unsigned long long> buckets[INST_BUCKETS];
+} Histogram;
+
+typedef struct HeldLock {
+  const void *lock;
+  int metric;
+  long long since;
+} HeldLock;
+
+typedef struct ThreadStats {
+  char name[32];
+  Histogram metrics[INST_NUM_METRICS];
+  HeldLock held[INST_MAX_HELD];
+  int held_count;
+} ThreadStats;
+
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static vector<ThreadStats *> registry; // kept after the thread exits
+static thread_local ThreadStats *local_stats = nullptr;
+static volatile sig_atomic_t dump_requested = 0;
+static int dump_count = 0;
+
+static const char *command_names[INST_NUM_COMMANDS] = {
+    "open", "deposit", "withdraw", "balance", "close", "transfer",
+    "close_atm", "rollback", "exchange", "invest", "sleep"};
+static const char *lock_names[INST_NUM_LOCKS] = {"bank", "shard", "account",
+                                                 "log", "vip", "other"};
+static const char *sweep_names[INST_NUM_SWEEPS] = {"snapshot", "commission"};
+
+static ThreadStats *stats() {
+  if (local_stats == nullptr) {
+    local_stats = new ThreadStats(); // value-initialized, all zero
+    pthread_mutex_lock(&registry_lock);
+    snprintf(local_stats->name, sizeof(local_stats->name), "thread-%zu",
+             registry.size());
+    registry.push_back(local_stats);
+    pthread_mutex_unlock(&registry_lock);
+  }
+  return local_stats;
+}
+
+static void add(atomic<unsigned long long> &counter, unsigned long long n) {
+  counter.store(counter.load(memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+long long inst_now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void inst_record(int metric, long long ns) {
+  Histogram &h = stats()->metrics[metric];
+  unsigned long long value = ns > 0 ? (unsigned long long)ns : 0;
+
+  add(h.count, 1);
+  add(h.total_ns, value);
+  add(h.buckets[63 - __builtin_clzll(value | 1)], 1);
+  if (value > h.max_ns.load(memory_order_relaxed)) {
+    h.max_ns.store(value, memory_order_relaxed);
+  }
+}
+
+void inst_acquired(const void *lock, InstLock kind, InstMode mode,
+                   long long wait_start) {
+  ThreadStats *s = stats();
+  long long now = inst_now_ns();
+
+  inst_record(INST_LOCK_METRIC(kind, mode, 0), now - wait_start);
+  if (s->held_count < INST_MAX_HELD) {
+    HeldLock &held = s->held[s->held_count++];
+    held.lock = lock;
+    held.metric = INST_LOCK_METRIC(kind, mode, 1);
+    held.since = now;
+  }
+}
+
+void inst_released(const void *lock) {
+  ThreadStats *s = stats();
+
+  // usually the most recent one, locks are released in reverse order
+  for (int i = s->held_count - 1; i >= 0; i--) {
+    if (s->held[i].lock == lock) {
+      inst_record(s->held[i].metric, inst_now_ns() - s->held[i].since);
+      for (int j = i; j < s->held_count - 1; j++) {
+        s->held[j] = s->held[j + 1];
+      }
+      s->held_count--;
+      return;
+    }
+  }
+}
+
+void inst_thread_name(const char *role, int index) {
+  ThreadStats *s = stats();
+  pthread_mutex_lock(&registry_lock);
+  if (index < 0) {
+    snprintf(s->name, sizeof(s->name), "%s", role);
+  } else {
+    snprintf(s->name, sizeof(s->name), "%s-%d", role, index);
+  }
+  pthread_mutex_unlock(&registry_lock);
+}
+
+static void on_dump_signal(int) { dump_requested = 1; }
+
+void inst_init() {
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = on_dump_signal;
+  action.sa_flags = SA_RESTART;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGUSR1, &action, NULL);
+}
+
+void inst_poll() {
+  if (dump_requested) {
+    dump_requested = 0;
+    inst_dump();
+  }
+}
+
+static void metric_name(int metric, char *out, size_t size) {
+  if (metric < INST_NUM_COMMANDS) {
+    snprintf(out, size, "cmd.%s", command_names[metric]);
+  } else if (metric < INST_SWEEP_METRIC(0)) {
+    int m = metric - INST_NUM_COMMANDS;
+    snprintf(out, size, "lock.%s.%s.%s", lock_names[m / 4],
+             (m / 2) % 2 ? "write" : "read", m % 2 ? "hold" : "wait");
+  } else {
+    snprintf(out, size, "sweep.%s", sweep_names[metric - INST_SWEEP_METRIC(0)]);
+  }
+}
+
+// Upper bound of the bucket the p-th sample falls in
+static unsigned long long percentile(const unsigned long long *buckets,
+                                     unsigned long long count, double p) {
+  unsigned long long rank = (unsigned long long)(p * (count - 1)) + 1;
+  unsigned long long seen = 0;
+  for (int b = 0; b < INST_BUCKETS; b++) {
+    seen += buckets[b];
+    if (seen >= rank) {
+      return b < 63 ? (1ULL << (b + 1)) : ~0ULL;
+    }
+  }
+  return 0;
+}
+
+static void print_histogram(FILE *out, const char *thread, int metric,
+                            unsigned long long count, unsigned long long total,
+                            unsigned long long max,
+                            const unsigned long long *buckets) {
+  char name[64];
+  metric_name(metric, name, sizeof(name));
+
+  fprintf(out,
+          "inst thread=%s metric=%s count=%llu total_ns=%llu max_ns=%llu "
+          "p50_ns=%llu p99_ns=%llu p999_ns=%llu buckets=",
+          thread, name, count, total, max, percentile(buckets, count, 0.50),
+          percentile(buckets, count, 0.99), percentile(buckets, count, 0.999));
+  bool first = true;
+  for (int b = 0; b < INST_BUCKETS; b++) {
+    if (buckets[b] > 0) {
+      fprintf(out, "%s%d:%llu", first ? "" : ",", b, buckets[b]);
+      first = false;
+    }
+  }
+  fprintf(out, "\n");
+}
+
+// Written to $BANK_INSTRUMENT_OUT (appended) or stderr:
+//   inst dump=<n> threads=<count>
+//   inst thread=<name> metric=<metric> count=.. total_ns=.. max_ns=..
+//        p50_ns=.. p99_ns=.. p999_ns=.. buckets=<log2 ns>:<count>,...
+// followed by the same lines summed over every thread (thread=all).
+void inst_dump() {
+  const char *path = getenv("BANK_INSTRUMENT_OUT");
+  FILE *out = (path != nullptr) ? fopen(path, "a") : stderr;
+  if (out == nullptr) {
+    return;
+  }
+
+  pthread_mutex_lock(&registry_lock);
+  fprintf(out, "inst dump=%d threads=%zu\n", ++dump_count, registry.size());
+
+  for (int metric = 0; metric < INST_NUM_METRICS; metric++) {
+    unsigned long long all_count = 0, all_total = 0, all_max = 0;
+    unsigned long long all_buckets[INST_BUCKETS] = {0};
+
+    for (ThreadStats *s : registry) {
+      Histogram &h = s->metrics[metric];
+      unsigned long long count = h.count.load(memory_order_relaxed);
+      if (count == 0) {
+        continue;
+      }
+      unsigned long long buckets[INST_BUCKETS];
+      for (int b = 0; b < INST_BUCKETS; b++) {
+        buckets[b] = h.buckets[b].load(memory_order_relaxed);
+        all_buckets[b] += buckets[b];
+      }
+      unsigned long long total = h.total_ns.load(memory_order_relaxed);
+      unsigned long long max = h.max_ns.load(memory_order_relaxed);
+      print_histogram(out, s->name, metric, count, total, max, buckets);
+
+      all_count += count;
+      all_total += total;
+      all_max = (max > all_max) ? max : all_max;
+    }
+    if (all_count > 0) {
+      print_histogram(out, "all", metric, all_count, all_total, all_max,
+                      all_buckets);
+    }
+  }
+  pthread_mutex_unlock(&registry_lock);
+
+  if (out != stderr) {
+    fclose(out);
+  } else {
+    fflush(out);
+  }
+}
+
+#endif
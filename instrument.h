@@ -0,0 +1,107 @@
+#ifndef INSTRUMENT_H
+#define INSTRUMENT_H
+
+// Hot path instrumentation, built only with -DBANK_INSTRUMENT (make INSTRUMENT=1).
+// Every thread records into its own log2(ns) histograms:
+//   cmd.<type>                      ATM::run_command latency per command type,
+//                                   batched commands get an equal share
+//   lock.<kind>.<read|write>.wait   time to acquire a lock
+//   lock.<kind>.<read|write>.hold   time the lock was held
+//   sweep.<snapshot|commission>     bank thread sweeps
+// The histograms are dumped at exit and whenever SIGUSR1 arrives, one
+// key=value line per thread and metric (see inst_dump).
+// Without BANK_INSTRUMENT all the INST_* macros expand to nothing.
+
+enum InstLock {
+  INST_LOCK_BANK,    // Bank::bank_lock
+  INST_LOCK_SHARD,   // AccountTable shard locks
+  INST_LOCK_ACCOUNT, // Account::lock
+  INST_LOCK_LOG,     // Log, enqueue (async) or write_lock (sync)
+  INST_LOCK_VIP,     // VipQueue bucket locks
+  INST_LOCK_OTHER,
+  INST_NUM_LOCKS
+};
+
+enum InstMode { INST_READ, INST_WRITE };
+
+enum InstSweep { INST_SWEEP_SNAPSHOT, INST_SWEEP_COMMISSION, INST_NUM_SWEEPS };
+
+#ifdef BANK_INSTRUMENT
+
+#define INST_NUM_COMMANDS 11 // CMD_OPEN .. CMD_SLEEP
+
+// Metric ids: commands first, then 4 per lock kind, then the sweeps
+#define INST_LOCK_METRIC(kind, mode, hold) \
+  (INST_NUM_COMMANDS + (kind) * 4 + (mode) * 2 + (hold))
+#define INST_SWEEP_METRIC(sweep) (INST_NUM_COMMANDS + INST_NUM_LOCKS * 4 + (sweep))
+#define INST_NUM_METRICS (INST_NUM_COMMANDS + INST_NUM_LOCKS * 4 + INST_NUM_SWEEPS)
+
+long long inst_now_ns();
+void inst_record(int metric, long long ns);
+void inst_acquired(const void *lock, InstLock kind, InstMode mode,
+                   long long wait_start);
+void inst_released(const void *lock);
+void inst_thread_name(const char *role, int index);
+void inst_init();   // installs the SIGUSR1 handler
+void inst_poll();   // dumps if SIGUSR1 arrived since the last call
+void inst_dump();
+
+class InstTimer {
+public:
+  explicit InstTimer(int metric) : metric(metric), start(inst_now_ns()) {}
+  ~InstTimer() { inst_record(metric, inst_now_ns() - start); }
+
+private:
+  int metric;
+  long long start;
+};
+
+#define INST_CONCAT2(a, b) a##b
+#define INST_CONCAT(a, b) INST_CONCAT2(a, b)
+
+#define INST_COMMAND(type) InstTimer INST_CONCAT(inst_timer_, __LINE__)(type)
+#define INST_SWEEP(sweep) \
+  InstTimer INST_CONCAT(inst_timer_, __LINE__)(INST_SWEEP_METRIC(sweep))
+
+// Commands run as one batch: INST_BATCH_BEGIN() before the first,
+// INST_BATCH_END(count) after the last, then INST_BATCH_COMMAND(type) for
+// each of them
+#define INST_BATCH_BEGIN() long long inst_batch_start = inst_now_ns()
+#define INST_BATCH_END(count) \
+  long long inst_batch_share = (inst_now_ns() - inst_batch_start) / (count)
+#define INST_BATCH_COMMAND(type) inst_record(type, inst_batch_share)
+
+// INST_LOCK_BEGIN() right before blocking on a lock, then either
+// INST_LOCK_ACQUIRED (starts the hold time, ended by INST_LOCK_RELEASE) or
+// INST_LOCK_WAITED (wait only, nothing is held afterwards)
+#define INST_LOCK_BEGIN() long long inst_wait_start = inst_now_ns()
+#define INST_LOCK_ACQUIRED(lock, kind, mode) \
+  inst_acquired(lock, kind, mode, inst_wait_start)
+#define INST_LOCK_WAITED(kind, mode) \
+  inst_record(INST_LOCK_METRIC(kind, mode, 0), inst_now_ns() - inst_wait_start)
+#define INST_LOCK_RELEASE(lock) inst_released(lock)
+
+#define INST_THREAD_NAME(role, index) inst_thread_name(role, index)
+#define INST_INIT() inst_init()
+#define INST_POLL() inst_poll()
+#define INST_DUMP() inst_dump()
+
+#else
+
+#define INST_COMMAND(type)
+#define INST_SWEEP(sweep)
+#define INST_BATCH_BEGIN()
+#define INST_BATCH_END(count)
+#define INST_BATCH_COMMAND(type)
+#define INST_LOCK_BEGIN()
+#define INST_LOCK_ACQUIRED(lock, kind, mode)
+#define INST_LOCK_WAITED(kind, mode)
+#define INST_LOCK_RELEASE(lock)
+#define INST_THREAD_NAME(role, index)
+#define INST_INIT()
+#define INST_POLL()
+#define INST_DUMP()
+
+#endif
+
+#endif
@@ -0,0 +1,282 @@
+#include "journal.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef struct FrameHeader {
+  uint32_t magic;
+  uint32_t size;    // payload bytes
+  uint32_t records;
+  uint32_t check;   // of the payload
+} FrameHeader;
+
+typedef struct RecordHeader {
+  uint8_t type;
+  uint8_t op;
+  uint8_t password_len;
+  uint8_t pad;
+  int32_t account;
+  int32_t value[NUM_CURRENCIES];
+} RecordHeader; // followed by password_len bytes and a JournalInvestment
+
+static bool has_investment(uint8_t type) {
+  return type == JOURNAL_INVEST || type == JOURNAL_SETTLE;
+}
+
+uint32_t journal_checksum(const char *data, size_t len) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < len; i++) {
+    hash ^= (uint8_t)data[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+/********** JournalBatch **********/
+
+void JournalBatch::add(JournalType type, JournalOp op, int account,
+                       const int *value, const string &password,
+                       const JournalInvestment *investment) {
+  RecordHeader record;
+  memset(&record, 0, sizeof(record));
+  record.type = (uint8_t)type;
+  record.op = (uint8_t)op;
+  record.password_len = (uint8_t)(password.size() < 255 ? password.size() : 255);
+  record.account = account;
+  for (int curr = 0; curr < NUM_CURRENCIES; curr++) {
+    record.value[curr] = value != nullptr ? value[curr] : 0;
+  }
+  data.append((const char *)&record, sizeof(record));
+  data.append(password, 0, record.password_len);
+  if (has_investment(record.type)) {
+    data.append((const char *)investment, sizeof(*investment));
+  }
+  records++;
+}
+
+void JournalBatch::close_account(int account, JournalOp op) {
+  add(JOURNAL_CLOSE, op, account, nullptr, string());
+}
+
+/********** Journal **********/
+
+Journal::Journal()
+    : fd(-1), appended_lsn(0), durable_lsn(0), syncing(false) {
+  pthread_mutex_init(&lock, NULL);
+  pthread_cond_init(&synced_cond, NULL);
+}
+
+Journal::~Journal() {
+  if (fd >= 0) {
+    flush();
+    close(fd);
+  }
+  pthread_mutex_destroy(&lock);
+  pthread_cond_destroy(&synced_cond);
+}
+
+// Decodes one frame's records, false if they don't add up
+static bool decode_frame(const char *data, const FrameHeader &frame,
+                         vector<JournalEntry> &entries) {
+  size_t pos = 0;
+  entries.clear();
+  for (uint32_t i = 0; i < frame.records; i++) {
+    RecordHeader record;
+    if (frame.size - pos < sizeof(record)) {
+      return false;
+    }
+    memcpy(&record, data + pos, sizeof(record));
+    pos += sizeof(record);
+    if (frame.size - pos < record.password_len ||
+        record.type < JOURNAL_OPEN || record.type > JOURNAL_SETTLE) {
+      return false;
+    }
+
+    JournalEntry entry;
+    entry.type = (JournalType)record.type;
+    entry.op = (JournalOp)record.op;
+    entry.account = record.account;
+    for (int curr = 0; curr < NUM_CURRENCIES; curr++) {
+      entry.value[curr] = record.value[curr];
+    }
+    entry.password.assign(data + pos, record.password_len);
+    pos += record.password_len;
+    memset(&entry.investment, 0, sizeof(entry.investment));
+    if (has_investment(record.type)) {
+      if (frame.size - pos < sizeof(entry.investment)) {
+        return false;
+      }
+      memcpy(&entry.investment, data + pos, sizeof(entry.investment));
+      pos += sizeof(entry.investment);
+    }
+    entries.push_back(entry);
+  }
+  return pos == frame.size;
+}
+
+// Closes file keeping errno, for the error paths of open()
+static bool open_failed(int file) {
+  int saved = errno;
+  close(file);
+  errno = saved;
+  return false;
+}
+
+bool Journal::open(const string &path, uint64_t offset,
+                   const function<void(const JournalEntry &, uint64_t)> &apply) {
+  int file = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+  if (file < 0) {
+    return false;
+  }
+
+  // read the rest of it whole, journals are replayed once at startup
+  struct stat st;
+  if (fstat(file, &st) != 0) {
+    return open_failed(file);
+  }
+  if ((uint64_t)st.st_size < offset) { // not the journal the offset is from
+    errno = EINVAL;
+    return open_failed(file);
+  }
+  if (lseek(file, offset, SEEK_SET) < 0) {
+    return open_failed(file);
+  }
+  string contents;
+  char buf[1 << 16];
+  ssize_t n;
+  while ((n = read(file, buf, sizeof(buf))) != 0) {
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return open_failed(file);
+    }
+    contents.append(buf, n);
+  }
+
+  size_t valid = 0;
+  vector<JournalEntry> entries;
+  while (contents.size() - valid >= sizeof(FrameHeader)) {
+    FrameHeader frame;
+    memcpy(&frame, contents.data() + valid, sizeof(frame));
+    const char *payload = contents.data() + valid + sizeof(frame);
+    if (frame.magic != JOURNAL_MAGIC ||
+        contents.size() - valid - sizeof(frame) < frame.size ||
+        journal_checksum(payload, frame.size) != frame.check ||
+        !decode_frame(payload, frame, entries)) {
+      break; // torn or corrupt - everything after it is lost
+    }
+    for (const JournalEntry &entry : entries) {
+      apply(entry, offset + valid);
+    }
+    valid += sizeof(frame) + frame.size;
+  }
+
+  // new frames go right after the last whole one
+  uint64_t end = offset + valid;
+  if ((valid < contents.size() && ftruncate(file, end) != 0) ||
+      lseek(file, end, SEEK_SET) < 0) {
+    return open_failed(file);
+  }
+
+  fd = file;
+  appended_lsn = durable_lsn = end;
+  return true;
+}
+
+uint64_t Journal::end_offset() {
+  pthread_mutex_lock(&lock);
+  uint64_t end = appended_lsn;
+  pthread_mutex_unlock(&lock);
+  return end;
+}
+
+void Journal::append(const JournalBatch &batch) {
+  if (fd < 0 || batch.empty()) {
+    return;
+  }
+
+  FrameHeader frame;
+  frame.magic = JOURNAL_MAGIC;
+  frame.size = (uint32_t)batch.data.size();
+  frame.records = (uint32_t)batch.records;
+  frame.check = journal_checksum(batch.data.data(), batch.data.size());
+
+  pthread_mutex_lock(&lock);
+  pending.append((const char *)&frame, sizeof(frame));
+  pending.append(batch.data);
+  appended_lsn += sizeof(frame) + batch.data.size();
+  pthread_mutex_unlock(&lock);
+}
+
+void Journal::delta(JournalOp op, int account, const int *delta) {
+  if (fd < 0) {
+    return;
+  }
+  JournalBatch batch;
+  batch.delta(op, account, delta);
+  append(batch);
+}
+
+void Journal::delta(JournalOp op, int account, Currency curr, int amount) {
+  if (fd < 0) {
+    return;
+  }
+  int change[NUM_CURRENCIES] = {0};
+  change[curr] = amount;
+  delta(op, account, change);
+}
+
+// Group commit - returns once lsn is on disk, writing it if nobody else is
+void Journal::sync_to(uint64_t lsn) {
+  pthread_mutex_lock(&lock);
+  while (durable_lsn < lsn) {
+    if (syncing) { // ride along with the current leader or the next one
+      pthread_cond_wait(&synced_cond, &lock);
+      continue;
+    }
+
+    // lead: take everything appended so far
+    syncing = true;
+    string batch;
+    batch.swap(pending);
+    uint64_t target = appended_lsn;
+    pthread_mutex_unlock(&lock);
+
+    const char *data = batch.data();
+    size_t len = batch.size();
+    while (len > 0) {
+      ssize_t n = ::write(fd, data, len);
+      if (n < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        break;
+      }
+      data += n;
+      len -= n;
+    }
+    if (len > 0 || fdatasync(fd) != 0) {
+      // the changes are applied but can't be made durable
+      cerr << "Bank error: journal write failed: " << strerror(errno) << endl;
+      abort();
+    }
+
+    pthread_mutex_lock(&lock);
+    durable_lsn = target;
+    syncing = false;
+    pthread_cond_broadcast(&synced_cond);
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+void Journal::flush() {
+  if (fd < 0) {
+    return;
+  }
+  sync_to(end_offset());
+}
@@ -0,0 +1,161 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include "currency.h"
+#include <functional>
+#include <pthread.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Write-ahead journal of account state changes, enabled with
+// BANK_JOURNAL=<path>. Balance changes are recorded as deltas, which
+// commute, so appends from concurrent lock-free updates need no ordering
+// among themselves. They are appended under the same shard and bank locks
+// as the change, which orders them after opens, closes and rollbacks of
+// the same accounts.
+//
+// Appends go to a memory buffer and become durable with group commit: a
+// thread calling flush() while no sync runs becomes the leader and writes
+// everything buffered so far with one write() and one fdatasync(); threads
+// that call it meanwhile wait for that sync or lead the next one. The log
+// writer flushes before every batch of log lines it writes, so an ATM never
+// waits for the disk, yet no command shows up in log.txt before its records
+// are durable. The bank thread flushes every iteration for the changes
+// nobody logs (investment settlements).
+//
+// Investments are journaled with their terms, so a restart pays out the
+// ones that have no SETTLE record yet. A checkpoint journals the running
+// ones again (with no debit), their INVEST records may be before the
+// offset replay starts from.
+//
+// On disk the journal is a sequence of frames, one per batch:
+//   header  {magic, payload bytes, records, checksum of the payload}
+//   records {type, op, password length, pad, account, value[2], password}
+//           followed by a JournalInvestment for INVEST and SETTLE
+// in host byte order. Replay applies whole frames only and stops at the
+// first torn or corrupt one, which open() then cuts off.
+
+#define JOURNAL_MAGIC 0x4C4E524A // "JRNL"
+
+enum JournalType {
+  JOURNAL_OPEN = 1,   // value - initial balances
+  JOURNAL_CLOSE = 2,
+  JOURNAL_DELTA = 3,  // value - added to the balances
+  JOURNAL_SET = 4,    // value - balances, the account is opened if missing
+  JOURNAL_INVEST = 5, // value - the debit, zeros when carried over a checkpoint
+  JOURNAL_SETTLE = 6  // value - the payout, zeros if the account was closed
+};
+
+// What caused a record - commission deltas also move the bank's balances
+enum JournalOp {
+  JOURNAL_OP_OPEN = 1,
+  JOURNAL_OP_CLOSE,
+  JOURNAL_OP_DEPOSIT,
+  JOURNAL_OP_WITHDRAW,
+  JOURNAL_OP_TRANSFER,
+  JOURNAL_OP_EXCHANGE,
+  JOURNAL_OP_INVEST,
+  JOURNAL_OP_SETTLE,
+  JOURNAL_OP_COMMISSION,
+  JOURNAL_OP_ROLLBACK
+};
+
+// An investment's terms, INVEST and SETTLE records with the same id match
+typedef struct JournalInvestment {
+  uint64_t id;
+  int64_t due_ms;   // CLOCK_REALTIME, it survives a restart
+  int32_t amount;
+  int32_t time;     // ms, the interest is for all of it
+  int32_t currency;
+  int32_t pad;
+} JournalInvestment;
+
+typedef struct JournalEntry {
+  JournalType type;
+  JournalOp op;
+  int account;
+  int value[NUM_CURRENCIES];
+  string password; // OPEN and SET only
+  JournalInvestment investment; // INVEST and SETTLE only
+} JournalEntry;
+
+// Records replayed all or nothing
+class JournalBatch {
+private:
+  string data;
+  int records;
+
+  void add(JournalType type, JournalOp op, int account, const int *value,
+           const string &password, const JournalInvestment *investment = nullptr);
+
+  friend class Journal;
+
+public:
+  JournalBatch() : records(0) {}
+
+  void open_account(int account, const string &password, const int *balance) {
+    add(JOURNAL_OPEN, JOURNAL_OP_OPEN, account, balance, password);
+  }
+  void close_account(int account, JournalOp op = JOURNAL_OP_CLOSE);
+  void set_account(int account, const string &password, const int *balance) {
+    add(JOURNAL_SET, JOURNAL_OP_ROLLBACK, account, balance, password);
+  }
+  void delta(JournalOp op, int account, const int *delta) {
+    add(JOURNAL_DELTA, op, account, delta, string());
+  }
+  void invest(int account, const int *debit, const JournalInvestment &investment) {
+    add(JOURNAL_INVEST, JOURNAL_OP_INVEST, account, debit, string(), &investment);
+  }
+  void settle(int account, const int *payout, const JournalInvestment &investment) {
+    add(JOURNAL_SETTLE, JOURNAL_OP_SETTLE, account, payout, string(), &investment);
+  }
+
+  bool empty() const { return records == 0; }
+};
+
+class Journal {
+private:
+  int fd; // -1 - journal disabled
+
+  pthread_mutex_t lock;
+  pthread_cond_t synced_cond;
+  string pending;        // appended, not written yet
+  uint64_t appended_lsn; // file offset after the last append
+  uint64_t durable_lsn;  // file offset up to which it is on disk
+  bool syncing;          // a leader is writing
+
+  Journal(const Journal &) = delete;
+  Journal &operator=(const Journal &) = delete;
+
+  void sync_to(uint64_t lsn);
+
+public:
+  Journal();
+  ~Journal(); // makes everything appended durable
+
+  // Replays the file from offset on (a frame boundary, see end_offset())
+  // through apply(entry, frame offset), cuts off a torn tail and opens it
+  // for appending. Returns false with errno set if the file can't be used.
+  bool open(const string &path, uint64_t offset,
+            const function<void(const JournalEntry &, uint64_t)> &apply);
+  bool enabled() const { return fd >= 0; }
+
+  // File offset after the last append, the next frame starts here
+  uint64_t end_offset();
+
+  void append(const JournalBatch &batch);
+
+  // Single change shortcuts, no-ops when disabled
+  void delta(JournalOp op, int account, const int *delta);
+  void delta(JournalOp op, int account, Currency curr, int amount);
+
+  void flush(); // every append so far is on disk
+};
+
+// FNV-1a, enough to tell a torn write from a whole one
+uint32_t journal_checksum(const char *data, size_t len);
+
+#endif
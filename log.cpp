@@ -1,15 +1,54 @@
 #include "log.h"
+#include "instrument.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <sys/time.h>
+#include <time.h>
+#include <unistd.h>
 
-Log::Log() {
+#define LOG_BATCH_RESERVE (64 * 1024)
+
+LogConfig Log::config = {"log.txt", LOG_ASYNC != 0, LOG_FLUSH_RECORDS,
+                         LOG_FLUSH_INTERVAL_MS, LOG_SYNC_TO_DISK != 0};
+
+Log::Log()
+    : ring(nullptr), enqueue_pos(0), dequeue_pos(0), pending(0),
+      stopping(false) {
     pthread_mutex_init(&write_lock, NULL);
-    log_file.open("log.txt", ios::trunc); 
+    pthread_mutex_init(&wake_lock, NULL);
+    pthread_cond_init(&wake_cond, NULL);
+    log_fd = open(config.path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    if (config.async) {
+        ring = new Slot[LOG_RING_SIZE];
+        for (size_t i = 0; i < LOG_RING_SIZE; i++) {
+            ring[i].seq.store(i, memory_order_relaxed);
+        }
+        if (pthread_create(&writer, NULL, writer_func, this) != 0) {
+            delete[] ring; // fall back to writing in the caller
+            ring = nullptr;
+            config.async = false;
+        }
+    }
 }
 
 Log::~Log() {
-    if (log_file.is_open()) {
-        log_file.close();
+    if (ring != nullptr) {
+        // stop the writer, it drains everything still queued
+        pthread_mutex_lock(&wake_lock);
+        stopping = true;
+        pthread_cond_signal(&wake_cond);
+        pthread_mutex_unlock(&wake_lock);
+        pthread_join(writer, NULL);
+        delete[] ring;
+    }
+    if (log_fd >= 0) {
+        close(log_fd);
     }
     pthread_mutex_destroy(&write_lock);
+    pthread_mutex_destroy(&wake_lock);
+    pthread_cond_destroy(&wake_cond);
 }
 
 Log& Log::getInstance() {
@@ -17,12 +56,162 @@ Log& Log::getInstance() {
     return instance;
 }
 
-void Log::write(const string& msg) {
+void Log::configure(const LogConfig &new_config) { config = new_config; }
+
+void Log::set_before_write(const function<void()> &hook) {
     pthread_mutex_lock(&write_lock);
-    // Debugging output to console
-    if (log_file.is_open()) {
-        log_file << msg << endl;
-        log_file.flush(); // ensure it's written immediately (force write to disk)
-    }
+    before_write = hook;
     pthread_mutex_unlock(&write_lock);
-}
\ No newline at end of file
+}
+
+void Log::write(const string& msg) {
+    INST_LOCK_BEGIN();
+    if (ring == nullptr) {
+        pthread_mutex_lock(&write_lock);
+        INST_LOCK_ACQUIRED(&write_lock, INST_LOCK_LOG, INST_WRITE);
+        if (before_write) {
+            before_write();
+        }
+        string line = msg + '\n';
+        write_all(line.data(), line.size());
+        INST_LOCK_RELEASE(&write_lock);
+        pthread_mutex_unlock(&write_lock);
+        return;
+    }
+
+    // ring full - let the writer catch up
+    while (!enqueue(msg)) {
+        wake_writer();
+        sched_yield();
+    }
+    INST_LOCK_WAITED(INST_LOCK_LOG, INST_WRITE);
+
+    int now_pending = pending.fetch_add(1, memory_order_relaxed) + 1;
+    if (now_pending == config.flush_records) {
+        wake_writer();
+    }
+}
+
+void Log::write_all(const char *buf, size_t len) {
+    if (log_fd < 0) {
+        return;
+    }
+    while (len > 0) {
+        ssize_t n = ::write(log_fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return; // nothing sensible to do with a failing log
+        }
+        buf += n;
+        len -= n;
+    }
+    if (config.sync_to_disk) {
+        fdatasync(log_fd); // force write to disk
+    }
+}
+
+// Claim the next ring position and publish the record in it.
+// Returns false if the ring is full.
+bool Log::enqueue(const string &msg) {
+    size_t pos = enqueue_pos.load(memory_order_relaxed);
+    Slot *slot;
+
+    while (true) {
+        slot = &ring[pos & (LOG_RING_SIZE - 1)];
+        size_t seq = slot->seq.load(memory_order_acquire);
+        long diff = (long)seq - (long)pos;
+
+        if (diff == 0) {
+            if (enqueue_pos.compare_exchange_weak(pos, pos + 1,
+                                                  memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false; // writer has not freed this slot yet
+        } else {
+            pos = enqueue_pos.load(memory_order_relaxed);
+        }
+    }
+
+    slot->msg = msg; // reuses the slot's buffer once it has grown
+    slot->seq.store(pos + 1, memory_order_release);
+    return true;
+}
+
+void Log::wake_writer() {
+    pthread_mutex_lock(&wake_lock);
+    pthread_cond_signal(&wake_cond);
+    pthread_mutex_unlock(&wake_lock);
+}
+
+// Move every published record into batch, returns the number taken
+size_t Log::drain(string &batch) {
+    size_t taken = 0;
+
+    while (true) {
+        Slot *slot = &ring[dequeue_pos & (LOG_RING_SIZE - 1)];
+        if (slot->seq.load(memory_order_acquire) != dequeue_pos + 1) {
+            break; // empty, or the producer is still copying
+        }
+        batch += slot->msg;
+        batch += '\n';
+        slot->msg.clear();
+        slot->seq.store(dequeue_pos + LOG_RING_SIZE, memory_order_release);
+        dequeue_pos++;
+        taken++;
+    }
+    return taken;
+}
+
+void *Log::writer_func(void *arg) {
+    Log *log = (Log *)arg;
+    string batch;
+    batch.reserve(LOG_BATCH_RESERVE);
+
+    pthread_mutex_lock(&log->wake_lock);
+    while (true) {
+        bool count_reached = config.flush_records > 0 &&
+            log->pending.load(memory_order_relaxed) >= config.flush_records;
+
+        if (!count_reached && !log->stopping) {
+            if (config.flush_interval_ms > 0) {
+                struct timeval now;
+                gettimeofday(&now, NULL);
+                long nsec = now.tv_usec * 1000L +
+                            (config.flush_interval_ms % 1000) * 1000000L;
+                struct timespec deadline;
+                deadline.tv_sec = now.tv_sec + config.flush_interval_ms / 1000 +
+                                  nsec / 1000000000L;
+                deadline.tv_nsec = nsec % 1000000000L;
+                pthread_cond_timedwait(&log->wake_cond, &log->wake_lock,
+                                       &deadline);
+            } else {
+                pthread_cond_wait(&log->wake_cond, &log->wake_lock);
+            }
+        }
+        bool stop = log->stopping;
+        pthread_mutex_unlock(&log->wake_lock);
+
+        // one write() for everything that is queued
+        size_t taken = log->drain(batch);
+        if (taken > 0) {
+            log->pending.fetch_sub((int)taken, memory_order_relaxed);
+            pthread_mutex_lock(&log->write_lock);
+            if (log->before_write) {
+                log->before_write();
+            }
+            pthread_mutex_unlock(&log->write_lock);
+            log->write_all(batch.data(), batch.size());
+            batch.clear();
+        }
+
+        pthread_mutex_lock(&log->wake_lock);
+        if (stop && taken == 0) {
+            break; // nothing left after shutdown was requested
+        }
+    }
+    pthread_mutex_unlock(&log->wake_lock);
+    return nullptr;
+}
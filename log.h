@@ -1,29 +1,85 @@
 #ifndef LOG_H
 #define LOG_H
 
+#include <atomic>
+#include <functional>
 #include <iostream>
-#include <fstream>
 #include <string>
 #include <pthread.h>
 
 using namespace std;
 
+// Default logging mode, can be overridden at build time (-DLOG_ASYNC=0 ...)
+#ifndef LOG_ASYNC
+#define LOG_ASYNC 1 // producers enqueue, a background thread writes
+#endif
+#ifndef LOG_FLUSH_RECORDS
+#define LOG_FLUSH_RECORDS 256 // wake the writer once this many are pending
+#endif
+#ifndef LOG_FLUSH_INTERVAL_MS
+#define LOG_FLUSH_INTERVAL_MS 20 // write pending records at least this often
+#endif
+#ifndef LOG_SYNC_TO_DISK
+#define LOG_SYNC_TO_DISK 0 // fdatasync() after every batch / record
+#endif
+
+#define LOG_RING_SIZE 4096 // must be a power of 2
+
+typedef struct LogConfig {
+    const char *path;
+    bool async;
+    int flush_records;     // <= 0 - no record count trigger
+    int flush_interval_ms; // <= 0 - no timer, write on count or shutdown
+    bool sync_to_disk;
+} LogConfig;
+
 class Log {
 private:
-    ofstream log_file;
-    pthread_mutex_t write_lock;
+    typedef struct Slot {
+        atomic<size_t> seq; // ring position this slot is ready for
+        string msg;
+    } Slot;
+
+    static LogConfig config;
+
+    int log_fd;
+    pthread_mutex_t write_lock; // synchronous mode, and before_write
+    function<void()> before_write;
+
+    // Asynchronous mode - bounded multi-producer ring, drained by one writer
+    Slot *ring;
+    atomic<size_t> enqueue_pos;
+    size_t dequeue_pos; // writer thread only
+    atomic<int> pending;
+    bool stopping;
+    pthread_t writer;
+    pthread_mutex_t wake_lock;
+    pthread_cond_t wake_cond;
 
     Log(); 
     
     Log(const Log&) = delete;
     Log& operator=(const Log&) = delete;
 
+    void write_all(const char *buf, size_t len);
+    bool enqueue(const string &msg);
+    void wake_writer();
+    size_t drain(string &batch);
+    static void *writer_func(void *arg);
+
 public:
     ~Log();
 
     static Log& getInstance();
 
+    // Must be called before the first getInstance()
+    static void configure(const LogConfig &new_config);
+
     void write(const string& msg);
+
+    // Runs before records are written out (per batch in asynchronous mode),
+    // so whatever they report can be made durable first. Empty to remove.
+    void set_before_write(const function<void()> &hook);
 };
 
-#endif
\ No newline at end of file
+#endif
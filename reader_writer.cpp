@@ -1,34 +1,100 @@
 #include "reader_writer.h"
 #include <pthread.h>
 
-ReadWriteLock::ReadWriteLock() : readers(0) {
-  pthread_mutex_init(&readerLock, NULL);
-  pthread_mutex_init(&writerLock, NULL);
+ReadWriteLock::ReadWriteLock()
+    : state(0), waiting_readers(0), write_gen(0) {
+#ifdef BANK_INSTRUMENT
+  inst_kind = INST_LOCK_OTHER;
+#endif
+  pthread_mutex_init(&lock, NULL);
+  pthread_cond_init(&readers_cond, NULL);
+  pthread_cond_init(&writers_cond, NULL);
 }
 
 ReadWriteLock::~ReadWriteLock() {
-  pthread_mutex_destroy(&readerLock);
-  pthread_mutex_destroy(&writerLock);
+  pthread_mutex_destroy(&lock);
+  pthread_cond_destroy(&readers_cond);
+  pthread_cond_destroy(&writers_cond);
 }
 
 void ReadWriteLock::readLock() {
-  pthread_mutex_lock(&readerLock);
-  readers++;
-  if (readers == 1) {
-    pthread_mutex_lock(&writerLock);
+  INST_LOCK_BEGIN();
+  read_acquire();
+  INST_LOCK_ACQUIRED(this, inst_kind, INST_READ);
+}
+
+void ReadWriteLock::read_acquire() {
+  // fast path - no writer around, just count ourselves in
+  int s = state.load(std::memory_order_relaxed);
+  while (!(s & WRITER)) {
+    if (state.compare_exchange_weak(s, s + 1, std::memory_order_acquire,
+                                    std::memory_order_relaxed)) {
+      return;
+    }
+  }
+
+  // slow path - a writer holds or waits for the lock
+  pthread_mutex_lock(&lock);
+  s = state.load(std::memory_order_relaxed);
+  while (!(s & WRITER)) { // writer left before we got the mutex
+    if (state.compare_exchange_weak(s, s + 1, std::memory_order_acquire,
+                                    std::memory_order_relaxed)) {
+      pthread_mutex_unlock(&lock);
+      return;
+    }
   }
-  pthread_mutex_unlock(&readerLock);
+
+  // wait for the writer ahead of us, it admits us on writeUnlock() under
+  // the same mutex, which also orders us after its writes
+  unsigned long gen = write_gen;
+  waiting_readers++;
+  while (gen == write_gen) {
+    pthread_cond_wait(&readers_cond, &lock);
+  }
+  pthread_mutex_unlock(&lock);
 }
 
 void ReadWriteLock::readUnlock() {
-  pthread_mutex_lock(&readerLock);
-  readers--;
-  if (readers == 0) {
-    pthread_mutex_unlock(&writerLock);
+  INST_LOCK_RELEASE(this);
+  int prev = state.fetch_sub(1, std::memory_order_release);
+  if (prev == (WRITER | 1)) {
+    // last reader out while a writer drains - wake it
+    pthread_mutex_lock(&lock);
+    pthread_cond_broadcast(&writers_cond);
+    pthread_mutex_unlock(&lock);
   }
-  pthread_mutex_unlock(&readerLock);
 }
 
-void ReadWriteLock::writeLock() { pthread_mutex_lock(&writerLock); }
+void ReadWriteLock::writeLock() {
+  INST_LOCK_BEGIN();
+  pthread_mutex_lock(&lock);
+
+  // one writer at a time owns the WRITER bit
+  while (state.load(std::memory_order_relaxed) & WRITER) {
+    pthread_cond_wait(&writers_cond, &lock);
+  }
+  state.fetch_or(WRITER, std::memory_order_relaxed); // stop new readers
 
-void ReadWriteLock::writeUnlock() { pthread_mutex_unlock(&writerLock); }
\ No newline at end of file
+  // drain the readers that are already inside
+  while (state.load(std::memory_order_acquire) != WRITER) {
+    pthread_cond_wait(&writers_cond, &lock);
+  }
+  pthread_mutex_unlock(&lock);
+  INST_LOCK_ACQUIRED(this, inst_kind, INST_WRITE);
+}
+
+void ReadWriteLock::writeUnlock() {
+  INST_LOCK_RELEASE(this);
+  pthread_mutex_lock(&lock);
+
+  // hand the lock to every queued reader at once (clears the WRITER bit)
+  state.store(waiting_readers, std::memory_order_release);
+  if (waiting_readers > 0) {
+    waiting_readers = 0;
+    write_gen++;
+    pthread_cond_broadcast(&readers_cond);
+  }
+  pthread_cond_broadcast(&writers_cond); // next writer waits for that batch
+
+  pthread_mutex_unlock(&lock);
+}
@@ -1,13 +1,33 @@
 #ifndef READER_WRITER_H
 #define READER_WRITER_H
 
+#include "instrument.h"
+#include <atomic>
 #include <pthread.h>
 
+// Writer-preferring, phase-fair reader/writer lock.
+// Readers take a fast path that only touches the atomic state word while no
+// writer holds or waits for the lock. A pending writer blocks new readers, and
+// when a writer releases, every reader that queued behind it is admitted as a
+// batch before the next writer gets in, so neither side can starve.
 class ReadWriteLock {
 private:
-    pthread_mutex_t readerLock;
-    pthread_mutex_t writerLock;
-    int readers;
+    static const int WRITER = 1 << 30; // writer active or pending
+
+    std::atomic<int> state; // active reader count | WRITER bit
+    pthread_mutex_t lock;   // slow path only
+    pthread_cond_t readers_cond;
+    pthread_cond_t writers_cond;
+    int waiting_readers;
+    unsigned long write_gen; // bumped on every writeUnlock()
+#ifdef BANK_INSTRUMENT
+    InstLock inst_kind;
+#endif
+
+    ReadWriteLock(const ReadWriteLock&) = delete;
+    ReadWriteLock& operator=(const ReadWriteLock&) = delete;
+
+    void read_acquire();
 
 public:
     ReadWriteLock();
@@ -16,6 +36,15 @@ public:
     void readUnlock();
     void writeLock();
     void writeUnlock();
+
+    // which lock.<kind>.* counters this lock reports to
+    void instrument_as(InstLock kind) {
+#ifdef BANK_INSTRUMENT
+        inst_kind = kind;
+#else
+        (void)kind;
+#endif
+    }
 };
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,105 @@
+#include "status_renderer.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+StatusRenderer::StatusRenderer(Bank *bank)
+    : bank(bank), interval_ms(STATUS_RENDER_DEFAULT ? STATUS_INTERVAL_MS : 0),
+      running(false), started(false) {
+  const char *env = getenv("BANK_STATUS");
+  if (env != nullptr) {
+    interval_ms = atoi(env);
+    if (interval_ms == 1) { // BANK_STATUS=1 - on with the default rate
+      interval_ms = STATUS_INTERVAL_MS;
+    }
+  }
+  pthread_mutex_init(&lock, NULL);
+  pthread_cond_init(&cond, NULL);
+}
+
+StatusRenderer::~StatusRenderer() {
+  stop();
+  pthread_mutex_destroy(&lock);
+  pthread_cond_destroy(&cond);
+}
+
+void StatusRenderer::start() {
+  if (!enabled() || started) {
+    return;
+  }
+  running = true;
+  if (pthread_create(&thread, NULL, render_func, this) == 0) {
+    started = true;
+  }
+}
+
+void StatusRenderer::stop() {
+  if (!started) {
+    return;
+  }
+  pthread_mutex_lock(&lock);
+  running = false;
+  pthread_cond_signal(&cond);
+  pthread_mutex_unlock(&lock);
+  pthread_join(thread, NULL);
+  started = false;
+}
+
+void StatusRenderer::render() {
+  bank->get_status_view(view);
+
+  frame.clear();
+  frame += "\033[2J";   // clear the console
+  frame += "\033[1;1H"; // move cursor to top-left corner
+  frame += "Current Bank Status\n";
+
+  for (auto const &data : view) {
+    frame += "Account " + to_string(data->id) + ": Balance - " +
+             to_string(data->balance[CURR_ILS]) + " ILS " +
+             to_string(data->balance[CURR_USD]) +
+             " USD, Account Password - " + data->password + "\n";
+  }
+  view.clear(); // drop the record references until the next frame
+
+  const char *buf = frame.data();
+  size_t len = frame.size();
+  while (len > 0) {
+    ssize_t n = write(STDOUT_FILENO, buf, len);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return;
+    }
+    buf += n;
+    len -= n;
+  }
+}
+
+void *StatusRenderer::render_func(void *arg) {
+  StatusRenderer *renderer = (StatusRenderer *)arg;
+
+  pthread_mutex_lock(&renderer->lock);
+  while (renderer->running) {
+    pthread_mutex_unlock(&renderer->lock);
+    renderer->render();
+    pthread_mutex_lock(&renderer->lock);
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    long nsec = now.tv_usec * 1000L + (renderer->interval_ms % 1000) * 1000000L;
+    struct timespec deadline;
+    deadline.tv_sec = now.tv_sec + renderer->interval_ms / 1000 +
+                      nsec / 1000000000L;
+    deadline.tv_nsec = nsec % 1000000000L;
+    while (renderer->running &&
+           pthread_cond_timedwait(&renderer->cond, &renderer->lock,
+                                  &deadline) != ETIMEDOUT) {
+    }
+  }
+  pthread_mutex_unlock(&renderer->lock);
+
+  renderer->render(); // final state
+  return nullptr;
+}
@@ -0,0 +1,49 @@
+#ifndef STATUS_RENDERER_H
+#define STATUS_RENDERER_H
+
+#include "bank.h"
+#include <pthread.h>
+#include <string>
+
+using namespace std;
+
+#ifndef STATUS_RENDER_DEFAULT
+#define STATUS_RENDER_DEFAULT 1 // print the bank status unless BANK_STATUS=0
+#endif
+#ifndef STATUS_INTERVAL_MS
+#define STATUS_INTERVAL_MS 100 // at most one frame per interval
+#endif
+
+// Prints the bank status to stdout from its own thread.
+// Frames are built from the latest snapshot view (Bank::get_status_view), so
+// no bank or account lock is taken, and each frame is one write() call.
+// BANK_STATUS in the environment overrides the build default: "0" disables
+// the renderer, a number sets the frame interval in ms.
+class StatusRenderer {
+private:
+  Bank *bank;
+  int interval_ms;
+  bool running;
+  bool started;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t cond;
+  vector<AccountRecord> view; // renderer thread only
+  string frame;
+
+  StatusRenderer(const StatusRenderer &) = delete;
+  StatusRenderer &operator=(const StatusRenderer &) = delete;
+
+  void render();
+  static void *render_func(void *arg);
+
+public:
+  StatusRenderer(Bank *bank);
+  ~StatusRenderer();
+
+  bool enabled() const { return interval_ms > 0; }
+  void start();
+  void stop(); // prints a last frame
+};
+
+#endif
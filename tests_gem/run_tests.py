@@ -10,10 +10,12 @@ import os
 import sys
 import time
 import re
+import struct
 from typing import List, Tuple, Dict, Optional
 
 # Configuration
 BANK_EXECUTABLE = "./bank"
+HOOKS_EXECUTABLE = "../build/test/bank"  # make test, for the crash tests
 LOG_FILE = "log.txt"
 TIMEOUT = 60  # seconds
 
@@ -26,16 +28,19 @@ class TestResult:
         self.stdout = ""
         self.stderr = ""
 
-def run_bank(num_vip_threads: int, input_files: List[str], timeout: int = TIMEOUT) -> Tuple[int, str, str]:
+def run_bank(num_vip_threads: int, input_files: List[str], timeout: int = TIMEOUT,
+             env: Optional[Dict[str, str]] = None,
+             exe: Optional[str] = None) -> Tuple[int, str, str]:
     """Run the bank executable with given parameters."""
-    cmd = [BANK_EXECUTABLE, str(num_vip_threads)] + input_files
+    cmd = [exe or BANK_EXECUTABLE, str(num_vip_threads)] + input_files
     try:
         result = subprocess.run(
             cmd,
             capture_output=True,
             text=True,
             timeout=timeout,
-            cwd=os.path.dirname(os.path.abspath(__file__)) or "."
+            cwd=os.path.dirname(os.path.abspath(__file__)) or ".",
+            env=dict(os.environ, **env) if env else None
         )
         return result.returncode, result.stdout, result.stderr
     except subprocess.TimeoutExpired:
@@ -157,6 +162,12 @@ def test_error_handling() -> TestResult:
         result.error_message = msg
         return result
     
+    # Unknown currency is rejected, not deposited as USD
+    if "Bank error: illegal arguments" not in stderr or \
+            "Account 2001 new balance" in log:
+        result.error_message = "Unknown currency was not rejected"
+        return result
+    
     result.passed = True
     return result
 
@@ -399,6 +410,39 @@ def test_vip_commands() -> TestResult:
     result.passed = True
     return result
 
+def test_vip_break() -> TestResult:
+    """A VIP break holds a VIP lane, not the ATM it came from."""
+    result = TestResult("VIP Break")
+    clean_log_file()
+    
+    # ATM 1 sends a 1.5 s VIP break and takes a 0.2 s break of its own,
+    # ATM 2 takes a 0.5 s break
+    retcode, stdout, stderr = run_bank(1, ["tests/test_vip_break1.txt",
+                                           "tests/test_vip_break2.txt"])
+    result.stdout = stdout
+    result.stderr = stderr
+    
+    log = read_log_file()
+    result.log_content = log
+    
+    expected_patterns = [
+        r"1: New account id is 15001",
+        r"2: New account id is 15002",
+    ]
+    
+    ok, msg = check_log_contains_pattern(log, expected_patterns)
+    if not ok:
+        result.error_message = msg
+        return result
+    
+    # ATM 1 goes on while its VIP break runs, so it opens its account first
+    if log.find("account id is 15001") > log.find("account id is 15002"):
+        result.error_message = "VIP break stalled ATM 1"
+        return result
+    
+    result.passed = True
+    return result
+
 def test_investment() -> TestResult:
     """Test investment operations."""
     result = TestResult("Investment")
@@ -554,6 +598,153 @@ def test_stress_multi_atm() -> TestResult:
     result.passed = True
     return result
 
+def hooks_missing() -> Optional[str]:
+    """Why the crash tests can't run, None if they can."""
+    script_dir = os.path.dirname(os.path.abspath(__file__))
+    if not os.path.exists(os.path.join(script_dir, HOOKS_EXECUTABLE)):
+        return f"No test build at {HOOKS_EXECUTABLE}, run make test"
+    return None
+
+def test_checkpoint_crash() -> TestResult:
+    """Kill the bank right after a checkpoint, while ATMs are still journaling,
+    then restart it from the checkpoint and the journal."""
+    result = TestResult("Checkpoint Crash")
+    result.error_message = hooks_missing() or ""
+    if result.error_message:
+        return result
+    clean_log_file()
+
+    script_dir = os.path.dirname(os.path.abspath(__file__))
+    trace = "crash_in.txt"
+    check = "crash_check.txt"
+    files = ["crash.journal", "crash.checkpoint", "crash.checkpoint.tmp", trace, check]
+
+    def cleanup():
+        for name in files:
+            try:
+                os.remove(os.path.join(script_dir, name))
+            except FileNotFoundError:
+                pass
+
+    cleanup()
+    deposits = 600000
+    with open(os.path.join(script_dir, trace), "w") as f:
+        f.write("O 30001 1234 0 0\n")
+        f.write("D 30001 1234 1 ILS\n" * deposits)
+    with open(os.path.join(script_dir, check), "w") as f:
+        f.write("B 30001 1234\n")
+    env = {"BANK_JOURNAL": "crash.journal", "BANK_CHECKPOINT": "crash.checkpoint"}
+
+    try:
+        # three ATMs on the same trace keep appending past the first checkpoint
+        crash_env = dict(env, BANK_TEST_KILL_AFTER_CHECKPOINT="1")
+        retcode, stdout, stderr = run_bank(0, [trace, trace, trace], timeout=120,
+                                           env=crash_env, exe=HOOKS_EXECUTABLE)
+        if retcode != -9:
+            result.error_message = f"Bank was not killed after a checkpoint (exit {retcode})"
+            return result
+        logged = read_log_file().count("ILS was deposited")
+
+        # CheckpointHeader: magic, version, shards, accounts, bank_balance[2],
+        # passwords_size, then journal_offset[shards]
+        with open(os.path.join(script_dir, "crash.checkpoint"), "rb") as f:
+            header = f.read(32)
+            shards = struct.unpack_from("=I", header, 8)[0]
+            offsets = struct.unpack("=%dQ" % shards, f.read(8 * shards))
+        journal_size = os.path.getsize(os.path.join(script_dir, "crash.journal"))
+        if max(offsets) > journal_size:
+            result.error_message = (f"Checkpoint points at journal offset {max(offsets)}, "
+                                    f"the journal ends at {journal_size}")
+            return result
+
+        clean_log_file()
+        retcode, stdout, stderr = run_bank(0, [check], timeout=60, env=env)
+        result.stdout = stdout
+        result.stderr = stderr
+        log = read_log_file()
+        result.log_content = log
+        if retcode != 0 or "Bank error" in stderr:
+            result.error_message = f"Restart failed (exit {retcode}): {stderr.strip()}"
+            return result
+
+        match = re.search(r"Account 30001 balance is (\d+) ILS", log)
+        if not match:
+            result.error_message = "Restarted bank lost account 30001"
+            return result
+        # commissions only take money away, nothing beyond the trace appears
+        balance = int(match.group(1))
+        if logged == 0 or balance > 3 * deposits:
+            result.error_message = f"Balance {balance} after {logged} logged deposits"
+            return result
+    finally:
+        cleanup()
+
+    result.passed = True
+    return result
+
+def test_investment_crash() -> TestResult:
+    """Kill the bank while an investment is running, the restarted bank
+    must still pay it out."""
+    result = TestResult("Investment Crash")
+    result.error_message = hooks_missing() or ""
+    if result.error_message:
+        return result
+    clean_log_file()
+
+    script_dir = os.path.dirname(os.path.abspath(__file__))
+    trace = "invest_crash_in.txt"
+    check = "invest_crash_check.txt"
+    files = ["invest_crash.journal", "invest_crash.checkpoint",
+             "invest_crash.checkpoint.tmp", trace, check]
+
+    def cleanup():
+        for name in files:
+            try:
+                os.remove(os.path.join(script_dir, name))
+            except FileNotFoundError:
+                pass
+
+    cleanup()
+    # 1 ILS for 1000 ms pays 19 ILS, too little for any commission; it is
+    # due at about 1.5 s, the first checkpoint kills the bank at about 1 s
+    with open(os.path.join(script_dir, trace), "w") as f:
+        f.write("O 30002 1234 1 0\nS 500\nI 30002 1234 1 ILS 1000\nS 5000\n")
+    with open(os.path.join(script_dir, check), "w") as f:
+        f.write("S 1000\nB 30002 1234\n")
+    env = {"BANK_JOURNAL": "invest_crash.journal",
+           "BANK_CHECKPOINT": "invest_crash.checkpoint"}
+
+    try:
+        start = time.time()
+        retcode, stdout, stderr = run_bank(0, [trace], timeout=60,
+                                           env=dict(env, BANK_TEST_KILL_AFTER_CHECKPOINT="1"),
+                                           exe=HOOKS_EXECUTABLE)
+        if retcode != -9:
+            result.error_message = f"Bank was not killed after a checkpoint (exit {retcode})"
+            return result
+        if time.time() - start >= 1.5:
+            result.error_message = "Bank was killed after the investment matured"
+            return result
+
+        clean_log_file()
+        retcode, stdout, stderr = run_bank(0, [check], timeout=60, env=env)
+        result.stdout = stdout
+        result.stderr = stderr
+        log = read_log_file()
+        result.log_content = log
+        if retcode != 0 or "Bank error" in stderr:
+            result.error_message = f"Restart failed (exit {retcode}): {stderr.strip()}"
+            return result
+
+        if not re.search(r"Account 30002 balance is 19 ILS", log):
+            result.error_message = "The investment was not paid out after the restart"
+            return result
+    finally:
+        cleanup()
+
+    result.passed = True
+    return result
+
 def run_all_tests() -> List[TestResult]:
     """Run all tests and return results."""
     tests = [
@@ -566,12 +757,15 @@ def run_all_tests() -> List[TestResult]:
         test_concurrent_atms,
         test_multi_atm_transfers,
         test_vip_commands,
+        test_vip_break,
         test_investment,
         test_commission_charging,
         test_illegal_arguments,
         test_status_printing,
         test_close_atm,
         test_stress_multi_atm,
+        test_checkpoint_crash,
+        test_investment_crash,
     ]
     
     results = []
@@ -617,11 +811,18 @@ def main():
         default="../bank",  # Default to parent directory based on your structure
         help="Path to the bank executable (default: ../bank)"
     )
+    parser.add_argument(
+        "--hooks-exe",
+        default="../build/test/bank",
+        help="Bank built with the crash hooks, for the crash tests "
+             "(default: ../build/test/bank, make test)"
+    )
     args = parser.parse_args()
 
     # 2. Update Global Configuration
-    global BANK_EXECUTABLE
+    global BANK_EXECUTABLE, HOOKS_EXECUTABLE
     BANK_EXECUTABLE = args.exe
+    HOOKS_EXECUTABLE = args.hooks_exe
 
     # 3. Verify Executable Exists
     # We resolve the path relative to the script's location to be safe
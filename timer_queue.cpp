@@ -0,0 +1,96 @@
+#include "timer_queue.h"
+#include <time.h>
+
+TimerQueue::TimerQueue() : next_seq(0), running_callbacks(0), running(true) {
+  pthread_condattr_t attr;
+  pthread_condattr_init(&attr);
+  pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+
+  pthread_mutex_init(&lock, NULL);
+  pthread_cond_init(&timers_cond, &attr);
+  pthread_cond_init(&idle_cond, NULL);
+  pthread_condattr_destroy(&attr);
+
+  pthread_create(&thread, NULL, timer_func, this);
+}
+
+TimerQueue::~TimerQueue() {
+  drain();
+
+  pthread_mutex_lock(&lock);
+  running = false;
+  pthread_cond_signal(&timers_cond);
+  pthread_mutex_unlock(&lock);
+  pthread_join(thread, NULL);
+
+  pthread_mutex_destroy(&lock);
+  pthread_cond_destroy(&timers_cond);
+  pthread_cond_destroy(&idle_cond);
+}
+
+long long TimerQueue::now_us() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+void TimerQueue::schedule_after(int delay_ms,
+                                const function<void()> &callback) {
+  Timer timer;
+  timer.deadline_us = now_us() + (long long)(delay_ms > 0 ? delay_ms : 0) * 1000;
+  timer.callback = callback;
+
+  pthread_mutex_lock(&lock);
+  timer.seq = next_seq++;
+  bool earliest = timers.empty() || timer.deadline_us < timers.top().deadline_us;
+  timers.push(timer);
+  if (earliest) {
+    pthread_cond_signal(&timers_cond); // timer thread sleeps too long
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+void TimerQueue::drain() {
+  pthread_mutex_lock(&lock);
+  while (!timers.empty() || running_callbacks > 0) {
+    pthread_cond_wait(&idle_cond, &lock);
+  }
+  pthread_mutex_unlock(&lock);
+}
+
+void *TimerQueue::timer_func(void *arg) {
+  TimerQueue *queue = (TimerQueue *)arg;
+
+  pthread_mutex_lock(&queue->lock);
+  while (queue->running) {
+    if (queue->timers.empty()) {
+      pthread_cond_wait(&queue->timers_cond, &queue->lock);
+      continue;
+    }
+
+    long long deadline = queue->timers.top().deadline_us;
+    if (deadline > now_us()) {
+      struct timespec ts;
+      ts.tv_sec = deadline / 1000000LL;
+      ts.tv_nsec = (deadline % 1000000LL) * 1000;
+      pthread_cond_timedwait(&queue->timers_cond, &queue->lock, &ts);
+      continue; // re-check, an earlier timer may have been added
+    }
+
+    // run the callback without holding the lock
+    function<void()> callback = queue->timers.top().callback;
+    queue->timers.pop();
+    queue->running_callbacks++;
+    pthread_mutex_unlock(&queue->lock);
+
+    callback();
+
+    pthread_mutex_lock(&queue->lock);
+    queue->running_callbacks--;
+    if (queue->timers.empty() && queue->running_callbacks == 0) {
+      pthread_cond_broadcast(&queue->idle_cond);
+    }
+  }
+  pthread_mutex_unlock(&queue->lock);
+  return nullptr;
+}
@@ -0,0 +1,59 @@
+#ifndef TIMER_QUEUE_H
+#define TIMER_QUEUE_H
+
+#include <functional>
+#include <pthread.h>
+#include <queue>
+#include <vector>
+
+using namespace std;
+
+// Deadline scheduler with a single timer thread.
+// Callers register a callback with a delay and move on right away; the timer
+// thread sleeps until the earliest deadline and runs the callbacks that are
+// due, in deadline order (ties in registration order).
+class TimerQueue {
+private:
+  typedef struct Timer {
+    long long deadline_us; // CLOCK_MONOTONIC
+    unsigned long seq;
+    function<void()> callback;
+  } Timer;
+
+  struct Later {
+    bool operator()(const Timer &a, const Timer &b) const {
+      if (a.deadline_us != b.deadline_us) {
+        return a.deadline_us > b.deadline_us;
+      }
+      return a.seq > b.seq;
+    }
+  };
+
+  priority_queue<Timer, vector<Timer>, Later> timers;
+  unsigned long next_seq;
+  int running_callbacks;
+  bool running;
+
+  pthread_mutex_t lock;
+  pthread_cond_t timers_cond; // new earliest deadline or stop
+  pthread_cond_t idle_cond;   // queue drained
+  pthread_t thread;
+
+  TimerQueue(const TimerQueue &) = delete;
+  TimerQueue &operator=(const TimerQueue &) = delete;
+
+  static void *timer_func(void *arg);
+
+public:
+  TimerQueue();
+  ~TimerQueue(); // runs whatever is still pending first
+
+  static long long now_us();
+
+  void schedule_after(int delay_ms, const function<void()> &callback);
+
+  // Blocks until every registered callback has run
+  void drain();
+};
+
+#endif
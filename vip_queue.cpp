@@ -0,0 +1,66 @@
+#include "vip_queue.h"
+#include "instrument.h"
+
+VipQueue::VipQueue() {
+  for (int i = 0; i <= VIP_MAX_PRIORITY; i++) {
+    pthread_mutex_init(&buckets[i].lock, NULL);
+  }
+  for (int i = 0; i < VIP_BITMAP_WORDS; i++) {
+    occupied[i].store(0);
+  }
+}
+
+VipQueue::~VipQueue() {
+  for (int i = 0; i <= VIP_MAX_PRIORITY; i++) {
+    pthread_mutex_destroy(&buckets[i].lock);
+  }
+}
+
+void VipQueue::push(const Command &cmd) {
+  int priority = cmd.vip_priority;
+  if (priority < VIP_MIN_PRIORITY) {
+    priority = VIP_MIN_PRIORITY;
+  } else if (priority > VIP_MAX_PRIORITY) {
+    priority = VIP_MAX_PRIORITY;
+  }
+  Bucket &bucket = buckets[priority];
+
+  // the bit only changes under the bucket lock, so it matches the FIFO
+  INST_LOCK_BEGIN();
+  pthread_mutex_lock(&bucket.lock);
+  INST_LOCK_ACQUIRED(&bucket.lock, INST_LOCK_VIP, INST_WRITE);
+  bucket.commands.push_back(cmd);
+  occupied[priority / 64].fetch_or(1ULL << (priority % 64));
+  INST_LOCK_RELEASE(&bucket.lock);
+  pthread_mutex_unlock(&bucket.lock);
+}
+
+bool VipQueue::try_pop(Command &cmd) {
+  for (int word = VIP_BITMAP_WORDS - 1; word >= 0; word--) {
+    uint64_t bits = occupied[word].load();
+
+    while (bits != 0) {
+      int bit = 63 - __builtin_clzll(bits); // highest priority in the word
+      Bucket &bucket = buckets[word * 64 + bit];
+
+      INST_LOCK_BEGIN();
+      pthread_mutex_lock(&bucket.lock);
+      INST_LOCK_ACQUIRED(&bucket.lock, INST_LOCK_VIP, INST_WRITE);
+      if (!bucket.commands.empty()) {
+        cmd = bucket.commands.front();
+        bucket.commands.pop_front();
+        if (bucket.commands.empty()) {
+          occupied[word].fetch_and(~(1ULL << bit));
+        }
+        INST_LOCK_RELEASE(&bucket.lock);
+        pthread_mutex_unlock(&bucket.lock);
+        return true;
+      }
+      INST_LOCK_RELEASE(&bucket.lock);
+      pthread_mutex_unlock(&bucket.lock);
+
+      bits &= ~(1ULL << bit); // someone else emptied it, try the next one
+    }
+  }
+  return false;
+}
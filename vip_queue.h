@@ -0,0 +1,43 @@
+#ifndef VIP_QUEUE_H
+#define VIP_QUEUE_H
+
+#include "command.h"
+#include <atomic>
+#include <deque>
+#include <pthread.h>
+#include <stdint.h>
+
+using namespace std;
+
+#define VIP_MIN_PRIORITY 1
+#define VIP_MAX_PRIORITY 100
+#define VIP_BITMAP_WORDS ((VIP_MAX_PRIORITY + 64) / 64)
+
+// Priority queue for VIP commands.
+// One FIFO per priority level, each with its own lock, plus an occupancy
+// bitmap of the non-empty levels. Enqueue touches a single level and the
+// highest waiting command is found with a count-leading-zeros, so both
+// are O(1). Equal priorities keep their arrival order.
+class VipQueue {
+private:
+  typedef struct Bucket {
+    pthread_mutex_t lock;
+    deque<Command> commands;
+  } Bucket;
+
+  Bucket buckets[VIP_MAX_PRIORITY + 1]; // indexed by priority
+  atomic<uint64_t> occupied[VIP_BITMAP_WORDS];
+
+  VipQueue(const VipQueue &) = delete;
+  VipQueue &operator=(const VipQueue &) = delete;
+
+public:
+  VipQueue();
+  ~VipQueue();
+
+  void push(const Command &cmd);
+  // Never blocks, the executor runs one urgent task per pushed command
+  bool try_pop(Command &cmd);
+};
+
+#endif
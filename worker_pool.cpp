@@ -0,0 +1,95 @@
+#include "worker_pool.h"
+#include <unistd.h>
+
+WorkerPool::WorkerPool(int num_threads)
+    : task(nullptr), tasks(0), next_task(0), busy_workers(0), generation(0),
+      running(true) {
+  pthread_mutex_init(&lock, NULL);
+  pthread_cond_init(&work_cond, NULL);
+  pthread_cond_init(&done_cond, NULL);
+
+  if (num_threads <= 0) {
+    num_threads = (int)sysconf(_SC_NPROCESSORS_ONLN) - 1;
+    if (num_threads > WORKER_POOL_MAX_THREADS) {
+      num_threads = WORKER_POOL_MAX_THREADS;
+    }
+  }
+  for (int i = 0; i < num_threads; i++) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, worker_func, this) != 0) {
+      break; // the caller still runs every task
+    }
+    threads.push_back(thread);
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  pthread_mutex_lock(&lock);
+  running = false;
+  pthread_cond_broadcast(&work_cond);
+  pthread_mutex_unlock(&lock);
+
+  for (pthread_t thread : threads) {
+    pthread_join(thread, NULL);
+  }
+  pthread_mutex_destroy(&lock);
+  pthread_cond_destroy(&work_cond);
+  pthread_cond_destroy(&done_cond);
+}
+
+// Take tasks until there are none left
+void WorkerPool::work() {
+  while (true) {
+    int index = next_task.fetch_add(1);
+    if (index >= tasks) {
+      return;
+    }
+    (*task)(index);
+  }
+}
+
+void WorkerPool::run(int num_tasks, const function<void(int)> &job) {
+  pthread_mutex_lock(&lock);
+  task = &job;
+  tasks = num_tasks;
+  next_task.store(0);
+  busy_workers = (int)threads.size();
+  generation++;
+  pthread_cond_broadcast(&work_cond);
+  pthread_mutex_unlock(&lock);
+
+  work(); // the caller helps
+
+  pthread_mutex_lock(&lock);
+  while (busy_workers > 0) {
+    pthread_cond_wait(&done_cond, &lock);
+  }
+  task = nullptr;
+  pthread_mutex_unlock(&lock);
+}
+
+void *WorkerPool::worker_func(void *arg) {
+  WorkerPool *pool = (WorkerPool *)arg;
+  unsigned long seen = 0;
+
+  pthread_mutex_lock(&pool->lock);
+  while (true) {
+    while (pool->running && pool->generation == seen) {
+      pthread_cond_wait(&pool->work_cond, &pool->lock);
+    }
+    if (!pool->running) {
+      break;
+    }
+    seen = pool->generation;
+    pthread_mutex_unlock(&pool->lock);
+
+    pool->work();
+
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->busy_workers == 0) {
+      pthread_cond_signal(&pool->done_cond);
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+  return nullptr;
+}
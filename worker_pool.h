@@ -0,0 +1,45 @@
+#ifndef WORKER_POOL_H
+#define WORKER_POOL_H
+
+#include <atomic>
+#include <functional>
+#include <pthread.h>
+#include <vector>
+
+using namespace std;
+
+#define WORKER_POOL_MAX_THREADS 8
+
+// Fixed set of threads for data parallel sweeps.
+// run() hands out task indices 0..tasks-1 to the workers and the calling
+// thread, and returns once every task finished. One run() at a time.
+class WorkerPool {
+private:
+  vector<pthread_t> threads;
+  const function<void(int)> *task; // current job, valid during run()
+  int tasks;
+  atomic<int> next_task;
+  int busy_workers;
+  unsigned long generation; // bumped for every run()
+  bool running;
+
+  pthread_mutex_t lock;
+  pthread_cond_t work_cond;
+  pthread_cond_t done_cond;
+
+  WorkerPool(const WorkerPool &) = delete;
+  WorkerPool &operator=(const WorkerPool &) = delete;
+
+  void work();
+  static void *worker_func(void *arg);
+
+public:
+  // 0 threads - one per online CPU besides the caller, capped
+  explicit WorkerPool(int num_threads = 0);
+  ~WorkerPool();
+
+  int size() const { return (int)threads.size() + 1; } // with the caller
+  void run(int num_tasks, const function<void(int)> &job);
+};
+
+#endif